@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "args.h"
+#include "tokenizer.h"
+
+int main(int argc, char* argv[])
+{
+  args::ArgumentParser parser("easytokenizer-cpp batch encode sweep: fixed num_threads vs AUTO_THREADS.");
+  args::HelpFlag help(parser, "help", "Show help information", {'h', "help"});
+  args::ValueFlag<std::string> vocabPath(
+      parser, "", "Tokenizer vocabulary file.", {"vocab_path"});
+  args::ValueFlag<int> maxThreads(
+      parser, "", "Largest fixed number of threads in the sweep.", {"max_threads"});
+  args::ValueFlag<int> numRounds(
+      parser, "", "Number of timed rounds.", {"num_rounds"});
+
+  // parse arguments
+  try
+  {
+    parser.ParseCLI(argc, argv);
+  }
+  catch (args::Help)
+  {
+    std::cerr << parser;
+    return 0;
+  }
+  catch (args::ParseError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+  catch (args::ValidationError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::string vocab_path;
+  int max_threads = std::max(1u, std::thread::hardware_concurrency());
+  int num_rounds = 5;
+  if (vocabPath)
+    vocab_path = args::get(vocabPath);
+  if (maxThreads)
+    max_threads = args::get(maxThreads);
+  if (numRounds)
+    num_rounds = args::get(numRounds);
+  if (vocab_path.empty())
+  {
+    std::cerr << parser;
+    throw std::invalid_argument("Get empty vocabulary file!");
+  }
+
+  tokenizer::Tokenizer AutoTokenizer(vocab_path, true, true);
+
+  auto t0 = std::chrono::steady_clock::now();
+  const tokenizer::ParallelCost& cost = AutoTokenizer.parallel_cost();
+  auto t1 = std::chrono::steady_clock::now();
+  std::cout << "Calibration  ns/byte: " << cost.ns_per_byte << "  ns/thread: " <<
+      cost.ns_per_thread << "  time: " <<
+      std::chrono::duration<double, std::milli>(t1 - t0).count() << "ms" << std::endl;
+
+  std::string sentence = "计算机科学与技术（Computer Science and Technology）是一门普通高等学校本科专业。";
+  std::vector<int> thread_counts;
+  for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+    thread_counts.emplace_back(num_threads);
+
+  std::vector<std::vector<int>> input_ids;
+  std::vector<std::vector<int>> attention_mask;
+  std::vector<std::vector<int>> offsets;
+  auto best_of = [&](const std::function<void()>& func)
+  {
+    double best = 0;
+    for (int r = 0; r < num_rounds; r++)
+    {
+      auto start = std::chrono::steady_clock::now();
+      func();
+      auto end = std::chrono::steady_clock::now();
+      double t = std::chrono::duration<double, std::micro>(end - start).count();
+      if (r == 0 || t < best)
+        best = t;
+    }
+    return best;
+  };
+
+  std::cout << "batch_size  text_bytes";
+  for (size_t k = 0; k < thread_counts.size(); k++)
+    std::cout << "  " << thread_counts[k] << "(us)";
+  std::cout << "  auto(us)  auto_threads" << std::endl;
+  for (int batch_size : {1, 4, 16, 64, 256, 1024})
+  {
+    for (int repeat : {1, 16})
+    {
+      std::string text;
+      for (int i = 0; i < repeat; i++)
+        text.append(sentence);
+      std::vector<std::string> texts(batch_size, text);
+
+      std::cout << batch_size << "  " << text.size();
+      for (size_t k = 0; k < thread_counts.size(); k++)
+        std::cout << "  " << best_of([&]()
+        {
+          AutoTokenizer.encode(texts, input_ids, attention_mask, offsets, thread_counts[k]);
+        });
+      double t_auto = best_of([&]()
+      {
+        AutoTokenizer.encode(texts, input_ids, attention_mask, offsets,
+          tokenizer::AUTO_THREADS);
+      });
+      // the batch APIs count 64 bytes of overhead per text
+      int chosen = AutoTokenizer.auto_threads(batch_size * (text.size() + 64), batch_size);
+      std::cout << "  " << t_auto << "  " << chosen << std::endl;
+    }
+  }
+
+  return 0;
+}
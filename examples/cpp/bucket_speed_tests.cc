@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "args.h"
+#include "tokenizer.h"
+
+int main(int argc, char* argv[])
+{
+  args::ArgumentParser parser("easytokenizer-cpp padding of input-order batches vs length buckets.");
+  args::HelpFlag help(parser, "help", "Show help information", {'h', "help"});
+  args::ValueFlag<std::string> vocabPath(
+      parser, "", "Tokenizer vocabulary file.", {"vocab_path"});
+  args::ValueFlag<std::string> sentPath(
+      parser, "", "Sentence data path, mixed-length texts are generated if not given.", {"sent_path"});
+  args::ValueFlag<int> numSents(
+      parser, "", "Number of generated sentences.", {"num_sents"});
+  args::ValueFlag<int> numThreads(
+      parser, "", "Number of parallel threads.", {"num_threads"});
+  args::ValueFlag<int> batchSize(
+      parser, "", "Batch size.", {"batch_size"});
+  args::ValueFlag<int> maxTokens(
+      parser, "", "Token budget per bucket, 0 for no budget.", {"max_tokens"});
+
+  // parse arguments
+  try
+  {
+    parser.ParseCLI(argc, argv);
+  }
+  catch (args::Help)
+  {
+    std::cerr << parser;
+    return 0;
+  }
+  catch (args::ParseError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+  catch (args::ValidationError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::string vocab_path, sent_path;
+  int num_sents = 20000;
+  int num_threads = 1;
+  int batch_size = 32;
+  int max_tokens = 0;
+  if (vocabPath)
+    vocab_path = args::get(vocabPath);
+  if (sentPath)
+    sent_path = args::get(sentPath);
+  if (numSents)
+    num_sents = args::get(numSents);
+  if (numThreads)
+    num_threads = args::get(numThreads);
+  if (batchSize)
+    batch_size = args::get(batchSize);
+  if (maxTokens)
+    max_tokens = args::get(maxTokens);
+  if (vocab_path.empty())
+  {
+    std::cerr << parser;
+    throw std::invalid_argument("Get empty vocabulary file!");
+  }
+
+  tokenizer::Tokenizer AutoTokenizer(vocab_path, true, true);
+
+  std::string sentence;
+  std::vector<std::string> sent_list;
+  if (sent_path.size())
+  {
+    std::ifstream ifs(sent_path);
+    if (!ifs.is_open())
+      throw std::invalid_argument(sent_path + " can not be opened for loading!");
+    while (std::getline(ifs, sentence))
+      if (sentence.size())
+        sent_list.emplace_back(sentence);
+  }
+  else
+  {
+    // log-normal number of clauses per text
+    std::string clause = "清华大学的计算机科学与技术专业实力全国第一，";
+    std::mt19937 rng(2022);
+    std::lognormal_distribution<double> dist(1.0, 1.0);
+    for (int i = 0; i < num_sents; i++)
+    {
+      int k = std::min(1 + int(dist(rng)), 40);
+      sentence.clear();
+      for (int j = 0; j < k; j++)
+        sentence.append(clause);
+      sent_list.emplace_back(sentence);
+    }
+  }
+
+  int n = sent_list.size();
+  size_t real_tokens = 0, plain_tokens = 0, bucket_tokens = 0;
+
+  // batches of batch_size texts in input order
+  std::vector<std::vector<int>> input_ids;
+  std::vector<std::vector<int>> attention_mask;
+  std::vector<std::vector<int>> offsets;
+  std::vector<std::string> batch_sent_list;
+  auto t0 = std::chrono::steady_clock::now();
+  for (int start = 0; start < n; start += batch_size)
+  {
+    int end = std::min(start + batch_size, n);
+    batch_sent_list.assign(sent_list.begin() + start, sent_list.begin() + end);
+    AutoTokenizer.encode(batch_sent_list, input_ids, attention_mask, offsets, num_threads);
+    for (size_t j = 0; j < input_ids.size(); j++)
+    {
+      plain_tokens += input_ids[j].size();
+      real_tokens += std::count(attention_mask[j].begin(), attention_mask[j].end(), 1);
+    }
+  }
+  auto t1 = std::chrono::steady_clock::now();
+
+  // length buckets over the whole set
+  std::vector<tokenizer::Bucket> buckets;
+  AutoTokenizer.encode_buckets(sent_list, buckets, batch_size, max_tokens, num_threads);
+  auto t2 = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < buckets.size(); i++)
+    for (size_t j = 0; j < buckets[i].input_ids.size(); j++)
+      bucket_tokens += buckets[i].input_ids[j].size();
+
+  double plain_time = std::chrono::duration<double>(t1 - t0).count();
+  double bucket_time = std::chrono::duration<double>(t2 - t1).count();
+  std::cout << "Number of sentences: " << n << "  batch_size: " << batch_size <<
+      "  max_tokens: " << max_tokens << "  real tokens: " << real_tokens << std::endl;
+  std::cout << "input order  batches: " << (n + batch_size - 1) / batch_size <<
+      "  padded tokens: " << plain_tokens << "  padding ratio: " <<
+      1 - double(real_tokens) / plain_tokens << "  encode time: " << plain_time << "s" << std::endl;
+  std::cout << "buckets      batches: " << buckets.size() << "  padded tokens: " <<
+      bucket_tokens << "  padding ratio: " << 1 - double(real_tokens) / bucket_tokens <<
+      "  encode time: " << bucket_time << "s" << std::endl;
+  std::cout << "Padded tokens saved: " << 1 - double(bucket_tokens) / plain_tokens << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,136 @@
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "args.h"
+#include "tokenizer.h"
+
+int main(int argc, char* argv[])
+{
+  args::ArgumentParser parser("easytokenizer-cpp batch encode of repeated texts with and without cache.");
+  args::HelpFlag help(parser, "help", "Show help information", {'h', "help"});
+  args::ValueFlag<std::string> vocabPath(
+      parser, "", "Tokenizer vocabulary file.", {"vocab_path"});
+  args::ValueFlag<std::string> sentPath(
+      parser, "", "Sentence data path, the distinct queries are generated if not given.", {"sent_path"});
+  args::ValueFlag<int> numQueries(
+      parser, "", "Number of queries drawn from a zipf distribution over the sentences.", {"num_queries"});
+  args::ValueFlag<int> numThreads(
+      parser, "", "Number of parallel threads.", {"num_threads"});
+  args::ValueFlag<int> batchSize(
+      parser, "", "Batch size.", {"batch_size"});
+  args::ValueFlag<int> cacheSize(
+      parser, "", "Cache capacity.", {"cache_size"});
+
+  // parse arguments
+  try
+  {
+    parser.ParseCLI(argc, argv);
+  }
+  catch (args::Help)
+  {
+    std::cerr << parser;
+    return 0;
+  }
+  catch (args::ParseError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+  catch (args::ValidationError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::string vocab_path, sent_path;
+  int num_queries = 200000;
+  int num_threads = 1;
+  int batch_size = 64;
+  int cache_size = 10000;
+  if (vocabPath)
+    vocab_path = args::get(vocabPath);
+  if (sentPath)
+    sent_path = args::get(sentPath);
+  if (numQueries)
+    num_queries = args::get(numQueries);
+  if (numThreads)
+    num_threads = args::get(numThreads);
+  if (batchSize)
+    batch_size = args::get(batchSize);
+  if (cacheSize)
+    cache_size = args::get(cacheSize);
+  if (vocab_path.empty())
+  {
+    std::cerr << parser;
+    throw std::invalid_argument("Get empty vocabulary file!");
+  }
+
+  tokenizer::Tokenizer AutoTokenizer(vocab_path, true, true);
+
+  std::string sentence;
+  std::vector<std::string> sent_list;
+  if (sent_path.size())
+  {
+    std::ifstream ifs(sent_path);
+    if (!ifs.is_open())
+      throw std::invalid_argument(sent_path + " can not be opened for loading!");
+    while (std::getline(ifs, sentence))
+      if (sentence.size())
+        sent_list.emplace_back(sentence);
+  }
+  else
+  {
+    for (int i = 0; i < 50000; i++)
+      sent_list.emplace_back("清华大学计算机科学与技术专业 query " + std::to_string(i));
+  }
+
+  // zipf(1) over the sentences, rank 0 is the most frequent
+  std::vector<double> weights(sent_list.size());
+  for (size_t i = 0; i < weights.size(); i++)
+    weights[i] = 1.0 / (i + 1);
+  std::mt19937 rng(2022);
+  std::discrete_distribution<size_t> dist(weights.begin(), weights.end());
+  std::vector<std::vector<std::string>> batches;
+  for (int i = 0; i < num_queries; i++)
+  {
+    if (i % batch_size == 0)
+      batches.emplace_back();
+    batches.back().emplace_back(sent_list[dist(rng)]);
+  }
+
+  std::vector<std::vector<int>> input_ids;
+  std::vector<std::vector<int>> attention_mask;
+  std::vector<std::vector<int>> offsets;
+  auto run = [&]()
+  {
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < batches.size(); i++)
+      AutoTokenizer.encode(batches[i], input_ids, attention_mask, offsets, num_threads);
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(t1 - t0).count();
+  };
+
+  double plain_time = run();
+  AutoTokenizer.set_cache(cache_size);
+  double cache_time = run();
+  tokenizer::CacheStats stats = AutoTokenizer.cache_stats();
+
+  std::cout << "queries: " << num_queries << "  distinct texts: " << sent_list.size() <<
+      "  batch_size: " << batch_size << "  cache_size: " << cache_size << std::endl;
+  std::cout << "no cache  time: " << plain_time << "s  " << num_queries / plain_time <<
+      " queries/s" << std::endl;
+  std::cout << "cache     time: " << cache_time << "s  " << num_queries / cache_time <<
+      " queries/s" << std::endl;
+  std::cout << "hits: " << stats.hits << "  misses: " << stats.misses << "  hit rate: " <<
+      stats.hit_rate() << "  in-batch duplicates: " << stats.duplicates << "  evictions: " <<
+      stats.evictions << std::endl;
+
+  return 0;
+}
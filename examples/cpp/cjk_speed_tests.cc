@@ -0,0 +1,136 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "args.h"
+#include "tokenizer.h"
+#include "utf8proc.h"
+
+int main(int argc, char* argv[])
+{
+  args::ArgumentParser parser("easytokenizer-cpp speed testing on pure Chinese text.");
+  args::HelpFlag help(parser, "help", "Show help information", {'h', "help"});
+  args::ValueFlag<std::string> vocabPath(
+      parser, "", "Tokenizer vocabulary file.", {"vocab_path"});
+  args::ValueFlag<std::string> sentPath(
+      parser, "", "Sentence data path, generated from the vocabulary if not given.", {"sent_path"});
+  args::ValueFlag<int> numSents(
+      parser, "", "Number of generated sentences.", {"num_sents"});
+  args::ValueFlag<int> sentLength(
+      parser, "", "Number of characters per generated sentence.", {"sent_length"});
+  args::ValueFlag<int> numRounds(
+      parser, "", "Number of timed rounds.", {"num_rounds"});
+
+  // parse arguments
+  try
+  {
+    parser.ParseCLI(argc, argv);
+  }
+  catch (args::Help)
+  {
+    std::cerr << parser;
+    return 0;
+  }
+  catch (args::ParseError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+  catch (args::ValidationError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::string vocab_path, sent_path;
+  int num_sents = 10000;
+  int sent_length = 128;
+  int num_rounds = 5;
+  if (vocabPath)
+    vocab_path = args::get(vocabPath);
+  if (sentPath)
+    sent_path = args::get(sentPath);
+  if (numSents)
+    num_sents = args::get(numSents);
+  if (sentLength)
+    sent_length = args::get(sentLength);
+  if (numRounds)
+    num_rounds = args::get(numRounds);
+  if (vocab_path.empty())
+  {
+    std::cerr << parser;
+    throw std::invalid_argument("Get empty vocabulary file!");
+  }
+
+  tokenizer::Tokenizer AutoTokenizer(vocab_path, true, true);
+
+  std::string sentence;
+  std::vector<std::string> sent_list;
+  if (sent_path.size())
+  {
+    std::ifstream ifs(sent_path);
+    if (!ifs.is_open())
+      throw std::invalid_argument(sent_path + " can not be opened for loading!");
+    while (std::getline(ifs, sentence))
+      if (sentence.size())
+        sent_list.emplace_back(sentence);
+  }
+  else
+  {
+    // sample CJK characters of the vocabulary
+    std::vector<std::string> chars;
+    for (int i = 0; i < AutoTokenizer.size(); i++)
+    {
+      auto token = AutoTokenizer.get_token(i);
+      int32_t unicode = 0;
+      auto len = utf8proc_iterate((const uint8_t*)token.data(), token.size(), &unicode);
+      if (len == (utf8proc_ssize_t)token.size() && unicode >= 0x4E00 && unicode <= 0x9FFF)
+        chars.emplace_back(token);
+    }
+    std::mt19937 rng(2022);
+    std::uniform_int_distribution<size_t> dist(0, chars.size() - 1);
+    for (int i = 0; i < num_sents; i++)
+    {
+      sentence.clear();
+      for (int j = 0; j < sent_length; j++)
+        sentence.append(chars[dist(rng)]);
+      sent_list.emplace_back(sentence);
+    }
+  }
+
+  size_t num_bytes = 0, num_tokens = 0;
+  for (size_t i = 0; i < sent_list.size(); i++)
+    num_bytes += sent_list[i].size();
+
+  std::vector<int> input_ids;
+  std::vector<int> attention_mask;
+  std::vector<int> offsets;
+  double best = 0;
+  for (int r = 0; r < num_rounds; r++)
+  {
+    num_tokens = 0;
+    std::chrono::steady_clock::time_point time_start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < sent_list.size(); i++)
+    {
+      AutoTokenizer.encode(sent_list[i], input_ids, attention_mask, offsets, true, false);
+      num_tokens += input_ids.size();
+    }
+    std::chrono::steady_clock::time_point time_end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> time_used = std::chrono::duration_cast<std::chrono::duration<double>>(
+        time_end - time_start);
+    if (r == 0 || time_used.count() < best)
+      best = time_used.count();
+  }
+
+  std::cout << "Number of sentences: " << sent_list.size() << "  bytes: " << num_bytes <<
+      "  tokens: " << num_tokens << std::endl;
+  std::cout << "Time usage: " << best << "s  " << num_bytes / best / 1e6 << " MB/s  " <<
+      num_tokens / best / 1e6 << " M tokens/s  " << best * 1e9 / num_tokens << " ns/token" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "args.h"
+#include "tokenizer.h"
+
+// batch encode with num_threads threads created and joined per call
+void encode_per_call_threads(const tokenizer::Tokenizer& AutoTokenizer,
+    const std::vector<std::string>& texts,
+    std::vector<std::vector<int>>& input_ids,
+    std::vector<std::vector<int>>& attention_mask,
+    std::vector<std::vector<int>>& offsets,
+    int num_threads)
+{
+  int n = texts.size();
+  input_ids.resize(n);
+  attention_mask.resize(n);
+  offsets.resize(n);
+  std::vector<std::thread> threads;
+  threads.reserve(static_cast<size_t>(num_threads));
+  auto func = [&](int start_index, int end_index)
+  {
+    for (int i = start_index; i < end_index; i++)
+      AutoTokenizer.encode(texts[i], input_ids[i], attention_mask[i], offsets[i]);
+  };
+  int start = 0, end = 0, step = ceil(n / float(num_threads));
+  for (int i = 0; i < num_threads; i++)
+  {
+    end = std::min(start + step, n);
+    threads.emplace_back(std::thread(func, start, end));
+    start = end;
+  }
+  for (auto& t : threads)
+    t.join();
+}
+
+double percentile(std::vector<double>& values, double p)
+{
+  std::sort(values.begin(), values.end());
+  size_t index = std::min(values.size() - 1, size_t(p * values.size()));
+  return values[index];
+}
+
+int main(int argc, char* argv[])
+{
+  args::ArgumentParser parser("easytokenizer-cpp small batch latency: per-call threads vs thread pool.");
+  args::HelpFlag help(parser, "help", "Show help information", {'h', "help"});
+  args::ValueFlag<std::string> vocabPath(
+      parser, "", "Tokenizer vocabulary file.", {"vocab_path"});
+  args::ValueFlag<std::string> sentPath(
+      parser, "", "Sentence data path to be processed.", {"sent_path"});
+  args::ValueFlag<int> numThreads(
+      parser, "", "Number of parallel threads.", {"num_threads"});
+  args::ValueFlag<int> batchSize(
+      parser, "", "Batch size.", {"batch_size"});
+  args::ValueFlag<int> numBatches(
+      parser, "", "Number of timed batches.", {"num_batches"});
+
+  // parse arguments
+  try
+  {
+    parser.ParseCLI(argc, argv);
+  }
+  catch (args::Help)
+  {
+    std::cerr << parser;
+    return 0;
+  }
+  catch (args::ParseError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+  catch (args::ValidationError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::string vocab_path, sent_path;
+  int num_threads = 4;
+  int batch_size = 32;
+  int num_batches = 2000;
+  if (vocabPath)
+    vocab_path = args::get(vocabPath);
+  if (sentPath)
+    sent_path = args::get(sentPath);
+  if (numThreads)
+    num_threads = args::get(numThreads);
+  if (batchSize)
+    batch_size = args::get(batchSize);
+  if (numBatches)
+    num_batches = args::get(numBatches);
+  if (vocab_path.empty())
+  {
+    std::cerr << parser;
+    throw std::invalid_argument("Get empty vocabulary file!");
+  }
+
+  tokenizer::Tokenizer AutoTokenizer(vocab_path, true, true);
+
+  std::string sentence;
+  std::vector<std::string> sent_list;
+  if (sent_path.size())
+  {
+    std::ifstream ifs(sent_path);
+    if (!ifs.is_open())
+      throw std::invalid_argument(sent_path + " can not be opened for loading!");
+    while (std::getline(ifs, sentence))
+      if (sentence.size())
+        sent_list.emplace_back(sentence);
+  }
+  else
+    sent_list.emplace_back("计算机科学与技术（Computer Science and Technology）是一门普通高等学校本科专业。");
+
+  std::vector<std::vector<std::string>> batches(num_batches);
+  for (int i = 0; i < num_batches; i++)
+    for (int j = 0; j < batch_size; j++)
+      batches[i].emplace_back(sent_list[(i * batch_size + j) % sent_list.size()]);
+
+  std::vector<std::vector<int>> input_ids;
+  std::vector<std::vector<int>> attention_mask;
+  std::vector<std::vector<int>> offsets;
+  std::vector<double> per_call, pool;
+  per_call.reserve(num_batches);
+  pool.reserve(num_batches);
+
+  // warm up the pool
+  AutoTokenizer.encode(batches[0], input_ids, attention_mask, offsets, num_threads);
+  for (int i = 0; i < num_batches; i++)
+  {
+    auto t0 = std::chrono::steady_clock::now();
+    encode_per_call_threads(AutoTokenizer, batches[i], input_ids, attention_mask, offsets,
+      num_threads);
+    auto t1 = std::chrono::steady_clock::now();
+    AutoTokenizer.encode(batches[i], input_ids, attention_mask, offsets, num_threads);
+    auto t2 = std::chrono::steady_clock::now();
+    per_call.emplace_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+    pool.emplace_back(std::chrono::duration<double, std::micro>(t2 - t1).count());
+  }
+
+  std::cout << "num_threads: " << num_threads << "  batch_size: " << batch_size <<
+      "  num_batches: " << num_batches << std::endl;
+  std::cout << "per-call threads  p50: " << percentile(per_call, 0.5) << "us  p99: " <<
+      percentile(per_call, 0.99) << "us" << std::endl;
+  std::cout << "thread pool       p50: " << percentile(pool, 0.5) << "us  p99: " <<
+      percentile(pool, 0.99) << "us" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "args.h"
+#include "tokenizer.h"
+
+double percentile(std::vector<double>& values, double p)
+{
+  std::sort(values.begin(), values.end());
+  size_t index = std::min(values.size() - 1, size_t(p * values.size()));
+  return values[index];
+}
+
+int main(int argc, char* argv[])
+{
+  args::ArgumentParser parser("easytokenizer-cpp query latency under concurrent bulk encoding.");
+  args::HelpFlag help(parser, "help", "Show help information", {'h', "help"});
+  args::ValueFlag<std::string> vocabPath(
+      parser, "", "Tokenizer vocabulary file.", {"vocab_path"});
+  args::ValueFlag<int> numThreads(
+      parser, "", "Number of parallel threads per encode call.", {"num_threads"});
+  args::ValueFlag<int> numBulk(
+      parser, "", "Number of threads issuing bulk batches.", {"num_bulk"});
+  args::ValueFlag<int> numQueries(
+      parser, "", "Number of timed queries per mode.", {"num_queries"});
+  args::ValueFlag<int> querySize(
+      parser, "", "Number of texts per query.", {"query_size"});
+
+  // parse arguments
+  try
+  {
+    parser.ParseCLI(argc, argv);
+  }
+  catch (args::Help)
+  {
+    std::cerr << parser;
+    return 0;
+  }
+  catch (args::ParseError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+  catch (args::ValidationError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::string vocab_path;
+  int num_threads = std::max(1u, std::thread::hardware_concurrency());
+  int num_bulk = 1;
+  int num_queries = 1000;
+  int query_size = 8;
+  if (vocabPath)
+    vocab_path = args::get(vocabPath);
+  if (numThreads)
+    num_threads = args::get(numThreads);
+  if (numBulk)
+    num_bulk = args::get(numBulk);
+  if (numQueries)
+    num_queries = args::get(numQueries);
+  if (querySize)
+    query_size = args::get(querySize);
+  if (vocab_path.empty())
+  {
+    std::cerr << parser;
+    throw std::invalid_argument("Get empty vocabulary file!");
+  }
+
+  tokenizer::Tokenizer AutoTokenizer(vocab_path, true, true);
+
+  std::string sentence = "计算机科学与技术（Computer Science and Technology）是一门普通高等学校本科专业。";
+  std::string document;
+  for (int i = 0; i < 20; i++)
+    document.append(sentence);
+  std::vector<std::string> query(query_size, sentence);
+  std::vector<std::string> bulk(1024, document);
+
+  // p50 and p99 query latency while num_bulk threads encode bulk batches
+  auto measure = [&](bool load, tokenizer::Priority bulk_priority, double& p50, double& p99)
+  {
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; load && t < num_bulk; t++)
+      threads.emplace_back([&]()
+      {
+        tokenizer::PriorityScope scope(bulk_priority);
+        std::vector<std::vector<int>> input_ids;
+        std::vector<std::vector<int>> attention_mask;
+        std::vector<std::vector<int>> offsets;
+        while (!stop)
+          AutoTokenizer.encode(bulk, input_ids, attention_mask, offsets, num_threads);
+      });
+
+    std::vector<std::vector<int>> input_ids;
+    std::vector<std::vector<int>> attention_mask;
+    std::vector<std::vector<int>> offsets;
+    std::vector<double> latency;
+    for (int i = 0; i < num_queries; i++)
+    {
+      auto t0 = std::chrono::steady_clock::now();
+      AutoTokenizer.encode(query, input_ids, attention_mask, offsets, num_threads);
+      auto t1 = std::chrono::steady_clock::now();
+      latency.emplace_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+      std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+    stop = true;
+    for (auto& t : threads)
+      t.join();
+    p50 = percentile(latency, 0.5);
+    p99 = percentile(latency, 0.99);
+  };
+
+  double p50 = 0, p99 = 0;
+  std::cout << "num_threads: " << num_threads << "  bulk threads: " << num_bulk <<
+      "  query_size: " << query_size << "  num_queries: " << num_queries << std::endl;
+  measure(false, tokenizer::PRIORITY_BULK, p50, p99);
+  std::cout << "no bulk load              p50: " << p50 << "us  p99: " << p99 << "us" << std::endl;
+  measure(true, tokenizer::PRIORITY_INTERACTIVE, p50, p99);
+  std::cout << "bulk at same priority     p50: " << p50 << "us  p99: " << p99 << "us" << std::endl;
+  measure(true, tokenizer::PRIORITY_BULK, p50, p99);
+  std::cout << "bulk at PRIORITY_BULK     p50: " << p50 << "us  p99: " << p99 << "us" << std::endl;
+
+  return 0;
+}
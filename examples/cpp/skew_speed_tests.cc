@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "args.h"
+#include "tokenizer.h"
+
+int main(int argc, char* argv[])
+{
+  args::ArgumentParser parser("easytokenizer-cpp batch encode scaling on skewed text lengths.");
+  args::HelpFlag help(parser, "help", "Show help information", {'h', "help"});
+  args::ValueFlag<std::string> vocabPath(
+      parser, "", "Tokenizer vocabulary file.", {"vocab_path"});
+  args::ValueFlag<int> numShort(
+      parser, "", "Number of short texts per batch.", {"num_short"});
+  args::ValueFlag<int> numLong(
+      parser, "", "Number of long texts per batch.", {"num_long"});
+  args::ValueFlag<int> longBytes(
+      parser, "", "Approximate size of a long text in bytes.", {"long_bytes"});
+  args::ValueFlag<int> maxThreads(
+      parser, "", "Largest number of threads in the sweep.", {"max_threads"});
+  args::ValueFlag<int> numRounds(
+      parser, "", "Number of timed rounds.", {"num_rounds"});
+
+  // parse arguments
+  try
+  {
+    parser.ParseCLI(argc, argv);
+  }
+  catch (args::Help)
+  {
+    std::cerr << parser;
+    return 0;
+  }
+  catch (args::ParseError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+  catch (args::ValidationError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::string vocab_path;
+  int num_short = 500;
+  int num_long = 4;
+  int long_bytes = 50000;
+  int max_threads = std::max(1u, std::thread::hardware_concurrency());
+  int num_rounds = 5;
+  if (vocabPath)
+    vocab_path = args::get(vocabPath);
+  if (numShort)
+    num_short = args::get(numShort);
+  if (numLong)
+    num_long = args::get(numLong);
+  if (longBytes)
+    long_bytes = args::get(longBytes);
+  if (maxThreads)
+    max_threads = args::get(maxThreads);
+  if (numRounds)
+    num_rounds = args::get(numRounds);
+  if (vocab_path.empty())
+  {
+    std::cerr << parser;
+    throw std::invalid_argument("Get empty vocabulary file!");
+  }
+
+  tokenizer::Tokenizer AutoTokenizer(vocab_path, true, true);
+
+  // a few long documents clustered at the end of many short texts
+  std::string sentence = "计算机科学与技术（Computer Science and Technology）是一门普通高等学校本科专业。";
+  std::string document;
+  while (int(document.size()) < long_bytes)
+    document.append(sentence);
+  std::vector<std::string> texts(num_short, sentence);
+  for (int i = 0; i < num_long; i++)
+    texts.emplace_back(document);
+  size_t num_bytes = 0;
+  for (size_t i = 0; i < texts.size(); i++)
+    num_bytes += texts[i].size();
+
+  std::vector<std::vector<int>> input_ids(texts.size());
+  std::vector<std::vector<int>> attention_mask(texts.size());
+  std::vector<std::vector<int>> offsets(texts.size());
+  tokenizer::ThreadPool pool;
+  auto encode_text = [&](int i)
+  {
+    AutoTokenizer.encode(texts[i], input_ids[i], attention_mask[i], offsets[i]);
+  };
+  auto best_of = [&](const std::function<void()>& func)
+  {
+    double best = 0;
+    for (int r = 0; r < num_rounds; r++)
+    {
+      auto t0 = std::chrono::steady_clock::now();
+      func();
+      auto t1 = std::chrono::steady_clock::now();
+      double t = std::chrono::duration<double>(t1 - t0).count();
+      if (r == 0 || t < best)
+        best = t;
+    }
+    return best;
+  };
+
+  std::cout << "texts: " << texts.size() << "  bytes: " << num_bytes << std::endl;
+  std::cout << "num_threads  static(s)  dynamic(s)  static(MB/s)  dynamic(MB/s)" << std::endl;
+  for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+  {
+    // contiguous ceil(n / num_threads) chunks
+    int n = texts.size();
+    int grain = (n + num_threads - 1) / num_threads;
+    double t_static = best_of([&]()
+    {
+      // same output handling as batch encode
+      input_ids.clear();
+      attention_mask.clear();
+      offsets.clear();
+      input_ids.resize(n);
+      attention_mask.resize(n);
+      offsets.resize(n);
+      pool.parallel_for(n, num_threads, grain, encode_text);
+    });
+    double t_dynamic = best_of([&]()
+    {
+      AutoTokenizer.encode(texts, input_ids, attention_mask, offsets, num_threads,
+        true, false);
+    });
+    std::cout << num_threads << "  " << t_static << "  " << t_dynamic << "  " <<
+        num_bytes / t_static / 1e6 << "  " << num_bytes / t_dynamic / 1e6 << std::endl;
+  }
+
+  return 0;
+}
@@ -1,13 +1,46 @@
 #include <algorithm>
 #include <chrono>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include "args.h"
 #include "tokenizer.h"
 
+double percentile(std::vector<double>& values, double p)
+{
+  if (values.empty())
+    return 0;
+  std::sort(values.begin(), values.end());
+  size_t index = std::min(values.size() - 1, size_t(p * values.size()));
+  return values[index];
+}
+
+// comma separated list of positive integers
+std::vector<int> parse_list(const std::string& text)
+{
+  std::vector<int> values;
+  std::stringstream ss(text);
+  std::string item;
+  while (std::getline(ss, item, ','))
+    if (item.size())
+      values.emplace_back(std::max(1, std::stoi(item)));
+  return values;
+}
+
+// latency percentiles in microseconds as a JSON object
+std::string latency_json(std::vector<double>& latency)
+{
+  std::ostringstream oss;
+  oss << "{\"p50_us\": " << percentile(latency, 0.5) << ", \"p95_us\": " <<
+      percentile(latency, 0.95) << ", \"p99_us\": " << percentile(latency, 0.99) <<
+      ", \"p999_us\": " << percentile(latency, 0.999) << "}";
+  return oss.str();
+}
+
 int main(int argc, char* argv[])
 {
   args::ArgumentParser parser("easytokenizer-cpp speed testing.");
@@ -24,7 +57,15 @@ int main(int argc, char* argv[])
       parser, "", "Number of parallel threads.", {"num_threads"});
   args::ValueFlag<int> batchSize(
       parser, "", "Batch size.", {"batch_size"});
-  
+  args::ValueFlag<std::string> threadSweep(
+      parser, "", "Comma separated numbers of threads to sweep, e.g. 1,2,4,8.", {"thread_sweep"});
+  args::ValueFlag<std::string> batchSweep(
+      parser, "", "Comma separated batch sizes to sweep, e.g. 1,32,128.", {"batch_sweep"});
+  args::ValueFlag<int> numRounds(
+      parser, "", "Number of timed passes over the sentences per configuration.", {"num_rounds"});
+  args::ValueFlag<std::string> jsonPath(
+      parser, "", "Path of the JSON report.", {"json_path"});
+
   // parse arguments
   try
   {
@@ -47,12 +88,13 @@ int main(int argc, char* argv[])
     std::cerr << parser;
     std::exit(EXIT_FAILURE);
   }
-  
-  std::string vocab_path, sent_path;
+
+  std::string vocab_path, sent_path, json_path;
   bool do_lower_case = false;
   bool codepoint_level = false;
   int num_threads = 1;
   int batch_size = 1;
+  int num_rounds = 3;
   if (vocabPath)
     vocab_path = args::get(vocabPath);
   if (doLowerCase)
@@ -65,15 +107,22 @@ int main(int argc, char* argv[])
     num_threads = args::get(numThreads);
   if (batchSize)
     batch_size = args::get(batchSize);
+  if (numRounds)
+    num_rounds = std::max(1, args::get(numRounds));
+  if (jsonPath)
+    json_path = args::get(jsonPath);
   if (vocab_path.empty() || sent_path.empty())
   {
     std::cerr << parser;
     throw std::invalid_argument("Get empty vocabulary/sentence file!");
   }
-  
+  std::vector<int> thread_counts = threadSweep ? parse_list(args::get(threadSweep)) :
+    std::vector<int>(1, num_threads);
+  std::vector<int> batch_sizes = batchSweep ? parse_list(args::get(batchSweep)) :
+    std::vector<int>(1, batch_size);
 
   tokenizer::Tokenizer AutoTokenizer(vocab_path, do_lower_case, codepoint_level);
-  
+
   std::string sentence;
   std::vector<std::string> sent_list;
   std::ifstream ifs(sent_path);
@@ -82,54 +131,102 @@ int main(int argc, char* argv[])
   while (std::getline(ifs, sentence))
     if (sentence.size())
       sent_list.emplace_back(sentence);
-  
-  int start = 0, end = 0, n = sent_list.size();
-  int num_batches = n > 0 ? ((n - 1) / batch_size + 1) : 0;
-  
-  std::vector<std::vector<int>> input_ids;
-  std::vector<std::vector<int>> attention_mask;
-  std::vector<std::vector<int>> offsets;
-  input_ids.reserve(n);
-  attention_mask.reserve(n);
-  offsets.reserve(n);
-  
+
+  int n = sent_list.size();
+  size_t num_bytes = 0, num_tokens = 0;
+  for (int i = 0; i < n; i++)
+    num_bytes += sent_list[i].size();
+
   bool add_cls_sep = true;
   bool padding = true;
   bool padding_to_max_length = false;
   bool truncation = true;
   int max_length = 512;
 
-  std::vector<std::string> batch_sent_list;
-  batch_sent_list.reserve(batch_size);
-  std::chrono::steady_clock::time_point time_start = std::chrono::steady_clock::now();
-  for (int i = 0; i < num_batches; i++)
+  // per-text latency of single sentence encode, which also counts the
+  // tokens and warms up the tokenizer
+  std::vector<int> ids, mask, offs;
+  std::vector<double> text_latency;
+  text_latency.reserve(n);
+  for (int i = 0; i < n; i++)
   {
-    batch_sent_list.clear();
-    start = i * batch_size;
-    end = std::min((i + 1) * batch_size, n);
-    for (int j = start; j < end; j++)
-      batch_sent_list.emplace_back(sent_list[j]);
-    
-    std::vector<std::vector<int>> batch_input_ids;
-    std::vector<std::vector<int>> batch_attention_mask;
-    std::vector<std::vector<int>> batch_offsets;
-    AutoTokenizer.encode(batch_sent_list, batch_input_ids, batch_attention_mask, batch_offsets, 
-      num_threads, add_cls_sep, padding, padding_to_max_length, truncation, max_length);
-    
-    for (int j = 0; j < batch_input_ids.size(); j++)
+    auto t0 = std::chrono::steady_clock::now();
+    AutoTokenizer.encode(sent_list[i], ids, mask, offs, add_cls_sep, truncation, max_length);
+    auto t1 = std::chrono::steady_clock::now();
+    text_latency.emplace_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+    num_tokens += ids.size();
+  }
+
+  std::cout << "Number of sentences: " << n << "  bytes: " << num_bytes << "  tokens: " <<
+      num_tokens << std::endl;
+  std::cout << "per-text latency  p50: " << percentile(text_latency, 0.5) << "us  p95: " <<
+      percentile(text_latency, 0.95) << "us  p99: " << percentile(text_latency, 0.99) <<
+      "us  p999: " << percentile(text_latency, 0.999) << "us" << std::endl;
+  std::cout << std::left << std::setw(12) << "num_threads" << std::setw(12) << "batch_size" <<
+      std::setw(12) << "time(s)" << std::setw(12) << "MB/s" << std::setw(14) << "Mtokens/s" <<
+      "batch p50/p95/p99/p999 (us)" << std::endl;
+
+  std::ostringstream runs;
+  for (size_t t = 0; t < thread_counts.size(); t++)
+  {
+    for (size_t b = 0; b < batch_sizes.size(); b++)
     {
-      input_ids.emplace_back(batch_input_ids[j]);
-      attention_mask.emplace_back(batch_attention_mask[j]);
-      offsets.emplace_back(batch_offsets[j]);
+      // batches are built outside the timed loop and the outputs are reused
+      int bs = batch_sizes[b];
+      std::vector<std::vector<std::string>> batches;
+      for (int start = 0; start < n; start += bs)
+        batches.emplace_back(sent_list.begin() + start,
+          sent_list.begin() + std::min(start + bs, n));
+
+      std::vector<std::vector<int>> input_ids;
+      std::vector<std::vector<int>> attention_mask;
+      std::vector<std::vector<int>> offsets;
+      std::vector<double> batch_latency, round_time;
+      batch_latency.reserve(batches.size() * num_rounds);
+      for (int r = 0; r < num_rounds; r++)
+      {
+        auto round_start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < batches.size(); i++)
+        {
+          auto t0 = std::chrono::steady_clock::now();
+          AutoTokenizer.encode(batches[i], input_ids, attention_mask, offsets, thread_counts[t],
+            add_cls_sep, padding, padding_to_max_length, truncation, max_length);
+          auto t1 = std::chrono::steady_clock::now();
+          batch_latency.emplace_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+        }
+        auto round_end = std::chrono::steady_clock::now();
+        round_time.emplace_back(std::chrono::duration<double>(round_end - round_start).count());
+      }
+
+      double seconds = percentile(round_time, 0.5);
+      double mb_per_s = num_bytes / seconds / 1e6;
+      double tokens_per_s = num_tokens / seconds;
+      std::ostringstream latency;
+      latency << percentile(batch_latency, 0.5) << "/" << percentile(batch_latency, 0.95) <<
+          "/" << percentile(batch_latency, 0.99) << "/" << percentile(batch_latency, 0.999);
+      std::cout << std::setw(12) << thread_counts[t] << std::setw(12) << bs << std::setw(12) <<
+          seconds << std::setw(12) << mb_per_s << std::setw(14) << tokens_per_s / 1e6 <<
+          latency.str() << std::endl;
+
+      runs << (runs.tellp() > 0 ? ",\n" : "") << "    {\"num_threads\": " << thread_counts[t] <<
+          ", \"batch_size\": " << bs << ", \"seconds\": " << seconds << ", \"mb_per_s\": " <<
+          mb_per_s << ", \"tokens_per_s\": " << tokens_per_s << ", \"batch_latency\": " <<
+          latency_json(batch_latency) << "}";
     }
   }
-  std::chrono::steady_clock::time_point time_end = std::chrono::steady_clock::now();
-  std::chrono::duration<double> time_used = std::chrono::duration_cast<std::chrono::duration<double>>(
-      time_end-time_start);
-  std::cout << "Number of sentences: " << n << "  num_threads: " << num_threads << 
-      "  batch_size: " << batch_size << std::endl;
-  std::cout << "Time usage: " << time_used.count() << "s." << std::endl;
-   
+
+  if (json_path.size())
+  {
+    std::ofstream ofs(json_path);
+    if (!ofs.is_open())
+      throw std::invalid_argument(json_path + " can not be opened for writing!");
+    ofs << "{\n  \"sentences\": " << n << ",\n  \"bytes\": " << num_bytes <<
+        ",\n  \"tokens\": " << num_tokens << ",\n  \"num_rounds\": " << num_rounds <<
+        ",\n  \"do_lower_case\": " << (do_lower_case ? "true" : "false") <<
+        ",\n  \"codepoint_level\": " << (codepoint_level ? "true" : "false") <<
+        ",\n  \"text_latency\": " << latency_json(text_latency) <<
+        ",\n  \"runs\": [\n" << runs.str() << "\n  ]\n}\n";
+  }
+
   return 0;
 }
-
@@ -0,0 +1,329 @@
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "args.h"
+#include "tokenizer.h"
+#include "utf8proc.h"
+
+// exposes the protected stages of the tokenizer
+class StageTokenizer : public tokenizer::Tokenizer
+{
+  public:
+    using tokenizer::Tokenizer::Tokenizer;
+
+    size_t special_scan(const std::string& text) const
+    { return _special->parse(text, _max_prefix_matches).size(); }
+
+    // lowercase and normalize every non-ASCII codepoint, as tokenize does
+    size_t normalize_codepoints(const std::string& text) const
+    {
+      size_t n = 0;
+      int32_t unicode = 0;
+      uint8_t ch[8];
+      auto data = reinterpret_cast<const uint8_t*>(text.data());
+      for (size_t i = 0; i < text.size(); )
+      {
+        auto len = utf8proc_iterate(data + i, text.size() - i, &unicode);
+        if (len <= 0)
+        {
+          i++;
+          continue;
+        }
+        i += len;
+        if (unicode < 0x80)
+          continue;
+        auto m = utf8proc_encode_char(utf8proc_tolower(unicode), ch);
+        ch[m] = '\0';
+        n += normalize(ch).size();
+      }
+      return n;
+    }
+
+    size_t exact_match(const std::vector<tokenizer::Token>& tokens) const
+    {
+      size_t n = 0;
+      for (size_t i = 0; i < tokens.size(); i++)
+        n += _vocab->get_index(std::get<2>(tokens[i])) >= 0;
+      return n;
+    }
+
+    size_t max_prefix(const std::vector<tokenizer::Token>& tokens) const
+    {
+      size_t n = 0, prefix_len = 0;
+      for (size_t i = 0; i < tokens.size(); i++)
+      {
+        const std::string& token = std::get<2>(tokens[i]);
+        n += _vocab->max_prefix(token.data(), token.size(), prefix_len) >= 0;
+      }
+      return n;
+    }
+
+    size_t wordpiece_ids(const std::string& text, std::vector<int>& input_ids,
+        std::vector<int>& offsets) const
+    {
+      input_ids.clear();
+      offsets.clear();
+      wordpiece(text, input_ids, nullptr, offsets);
+      return input_ids.size();
+    }
+
+    // byte to codepoint map of the text and position maps of its tokens
+    size_t offset_maps(const std::string& text, const std::vector<tokenizer::Token>& tokens,
+        std::vector<int>& byte2index, std::vector<int>& pos_map) const
+    {
+      build_index_map(text, byte2index);
+      for (size_t i = 0; i < tokens.size(); i++)
+      {
+        pos_map.clear();
+        int start = std::get<0>(tokens[i]), end = std::get<1>(tokens[i]);
+        build_pos_map(text.data() + start, end - start, pos_map);
+      }
+      return byte2index.size();
+    }
+
+    void pad_batch(std::vector<std::vector<int>>& input_ids,
+        std::vector<std::vector<int>>& attention_mask) const
+    { pad(input_ids, attention_mask, false, 512); }
+};
+
+// sentences of about sent_length bytes drawn from fragments
+std::vector<std::string> build_corpus(const std::vector<std::string>& fragments,
+    int num_sents, int sent_length, std::mt19937& rng)
+{
+  std::uniform_int_distribution<size_t> dist(0, fragments.size() - 1);
+  std::vector<std::string> sents;
+  for (int i = 0; i < num_sents; i++)
+  {
+    std::string sent;
+    while (int(sent.size()) < sent_length)
+    {
+      sent.append(fragments[dist(rng)]);
+      sent.push_back(' ');
+    }
+    sents.emplace_back(sent);
+  }
+  return sents;
+}
+
+int main(int argc, char* argv[])
+{
+  args::ArgumentParser parser("easytokenizer-cpp per-stage microbenchmarks on fixed corpora.");
+  args::HelpFlag help(parser, "help", "Show help information", {'h', "help"});
+  args::ValueFlag<std::string> vocabPath(
+      parser, "", "Tokenizer vocabulary file.", {"vocab_path"});
+  args::ValueFlag<int> numSents(
+      parser, "", "Number of sentences per corpus.", {"num_sents"});
+  args::ValueFlag<int> sentLength(
+      parser, "", "Sentence length in bytes.", {"sent_length"});
+  args::ValueFlag<int> numRounds(
+      parser, "", "Number of timed rounds.", {"num_rounds"});
+
+  // parse arguments
+  try
+  {
+    parser.ParseCLI(argc, argv);
+  }
+  catch (args::Help)
+  {
+    std::cerr << parser;
+    return 0;
+  }
+  catch (args::ParseError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+  catch (args::ValidationError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::string vocab_path;
+  int num_sents = 2000;
+  int sent_length = 256;
+  int num_rounds = 7;
+  if (vocabPath)
+    vocab_path = args::get(vocabPath);
+  if (numSents)
+    num_sents = args::get(numSents);
+  if (sentLength)
+    sent_length = args::get(sentLength);
+  if (numRounds)
+    num_rounds = args::get(numRounds);
+  if (vocab_path.empty())
+  {
+    std::cerr << parser;
+    throw std::invalid_argument("Get empty vocabulary file!");
+  }
+
+  StageTokenizer AutoTokenizer(vocab_path, true, true);
+
+  // CJK characters of the vocabulary
+  std::vector<std::string> cjk;
+  for (int i = 0; i < AutoTokenizer.size(); i++)
+  {
+    auto token = AutoTokenizer.get_token(i);
+    int32_t unicode = 0;
+    auto len = utf8proc_iterate((const uint8_t*)token.data(), token.size(), &unicode);
+    if (len == (utf8proc_ssize_t)token.size() && unicode >= 0x4E00 && unicode <= 0x9FFF)
+      cjk.emplace_back(token);
+  }
+  std::mt19937 rng(2022);
+  std::string letters = "abcdefghijklmnopqrstuvwxyz";
+  std::vector<std::string> long_words = {"pneumonoultramicroscopicsilicovolcanoconiosis",
+    "antidisestablishmentarianism", "supercalifragilisticexpialidocious",
+    "floccinaucinihilipilification", "hippopotomonstrosesquippedaliophobia"};
+  for (int i = 0; i < 64; i++)
+  {
+    std::string word;
+    for (int j = 0; j < 24 + i; j++)
+      word.push_back(letters[rng() % letters.size()]);
+    long_words.emplace_back(word);
+  }
+
+  std::vector<std::pair<std::string, std::vector<std::string>>> corpora;
+  corpora.emplace_back("ascii", build_corpus({"The", "quick", "brown", "fox", "jumps",
+    "over", "the", "lazy", "dog.", "Tokenization", "speed", "matters,", "2022", "models!",
+    "(see", "section", "3.1)", "and", "it's", "fine"}, num_sents, sent_length, rng));
+  corpora.emplace_back("cjk", build_corpus(cjk, num_sents, sent_length, rng));
+  corpora.emplace_back("latin", build_corpus({"Café", "déjà", "vu", "naïve", "résumé",
+    "Ångström", "façade", "über", "Straße", "coöperate", "élève", "Müller", "São",
+    "Paulo", "piñata"}, num_sents, sent_length, rng));
+  corpora.emplace_back("long_words", build_corpus(long_words, num_sents, sent_length, rng));
+  corpora.emplace_back("emoji", build_corpus({"😀", "Hello", "👍🏽", "world", "🎉🚀",
+    "测试", "❤️", "👨‍👩‍👧", "ok"}, num_sents, sent_length, rng));
+
+  std::cout << std::left << std::setw(12) << "corpus" << std::setw(16) << "stage" <<
+      std::setw(24) << "ns/byte" << "ns/token" << std::endl;
+  for (auto& corpus : corpora)
+  {
+    const std::vector<std::string>& sents = corpus.second;
+    size_t num_bytes = 0, num_tokens = 0;
+    std::vector<std::vector<tokenizer::Token>> base_tokens(sents.size());
+    std::vector<std::vector<int>> input_ids(sents.size());
+    std::vector<std::vector<int>> offsets(sents.size());
+    for (size_t i = 0; i < sents.size(); i++)
+    {
+      num_bytes += sents[i].size();
+      AutoTokenizer.tokenize(sents[i], 0, base_tokens[i]);
+      num_tokens += AutoTokenizer.wordpiece_ids(sents[i], input_ids[i], offsets[i]);
+    }
+
+    // mean and standard deviation over the rounds of one stage
+    size_t sink = 0;
+    auto measure = [&](const std::string& stage, const std::function<void()>& setup,
+        const std::function<void()>& func)
+    {
+      std::vector<double> times;
+      for (int r = 0; r < num_rounds; r++)
+      {
+        if (setup)
+          setup();
+        auto start = std::chrono::steady_clock::now();
+        func();
+        auto end = std::chrono::steady_clock::now();
+        times.emplace_back(std::chrono::duration<double, std::nano>(end - start).count());
+      }
+      double mean = 0, var = 0;
+      for (double t : times)
+        mean += t / times.size();
+      for (double t : times)
+        var += (t - mean) * (t - mean) / times.size();
+      double sd = std::sqrt(var);
+      std::ostringstream per_byte, per_token;
+      per_byte << std::fixed << std::setprecision(2) << mean / num_bytes << " +- " <<
+          sd / num_bytes;
+      per_token << std::fixed << std::setprecision(2) << mean / num_tokens << " +- " <<
+          sd / num_tokens;
+      std::cout << std::setw(12) << corpus.first << std::setw(16) << stage <<
+          std::setw(24) << per_byte.str() << per_token.str() << std::endl;
+    };
+
+    std::vector<tokenizer::Token> tokens;
+    std::vector<int> ids, offs, byte2index, pos_map;
+    measure("special_scan", nullptr, [&]()
+    {
+      for (size_t i = 0; i < sents.size(); i++)
+        sink += AutoTokenizer.special_scan(sents[i]);
+    });
+    measure("basic_tokenize", nullptr, [&]()
+    {
+      for (size_t i = 0; i < sents.size(); i++)
+      {
+        tokens.clear();
+        AutoTokenizer.tokenize(sents[i], 0, tokens);
+        sink += tokens.size();
+      }
+    });
+    measure("normalize", nullptr, [&]()
+    {
+      for (size_t i = 0; i < sents.size(); i++)
+        sink += AutoTokenizer.normalize_codepoints(sents[i]);
+    });
+    measure("exact_match", nullptr, [&]()
+    {
+      for (size_t i = 0; i < sents.size(); i++)
+        sink += AutoTokenizer.exact_match(base_tokens[i]);
+    });
+    measure("max_prefix", nullptr, [&]()
+    {
+      for (size_t i = 0; i < sents.size(); i++)
+        sink += AutoTokenizer.max_prefix(base_tokens[i]);
+    });
+    measure("wordpiece", nullptr, [&]()
+    {
+      for (size_t i = 0; i < sents.size(); i++)
+        sink += AutoTokenizer.wordpiece_ids(sents[i], ids, offs);
+    });
+    measure("offset_maps", nullptr, [&]()
+    {
+      for (size_t i = 0; i < sents.size(); i++)
+        sink += AutoTokenizer.offset_maps(sents[i], base_tokens[i], byte2index, pos_map);
+    });
+
+    // padding mutates its batches, so each round pads fresh copies
+    const size_t batch_size = 64;
+    std::vector<std::vector<std::vector<int>>> id_batches, mask_batches;
+    measure("padding", [&]()
+    {
+      id_batches.clear();
+      mask_batches.clear();
+      for (size_t i = 0; i < input_ids.size(); i += batch_size)
+      {
+        size_t end = std::min(input_ids.size(), i + batch_size);
+        id_batches.emplace_back(input_ids.begin() + i, input_ids.begin() + end);
+        mask_batches.emplace_back();
+        for (size_t j = i; j < end; j++)
+          mask_batches.back().emplace_back(input_ids[j].size(), 1);
+      }
+    }, [&]()
+    {
+      for (size_t b = 0; b < id_batches.size(); b++)
+        AutoTokenizer.pad_batch(id_batches[b], mask_batches[b]);
+    });
+
+    std::vector<int> mask;
+    measure("encode", nullptr, [&]()
+    {
+      for (size_t i = 0; i < sents.size(); i++)
+      {
+        AutoTokenizer.encode(sents[i], ids, mask, offs, true, false);
+        sink += ids.size();
+      }
+    });
+    if (sink == 0)
+      std::cout << std::endl;
+  }
+
+  return 0;
+}
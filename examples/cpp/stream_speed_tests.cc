@@ -0,0 +1,147 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "args.h"
+#include "stream_encoder.h"
+#include "tokenizer.h"
+
+// write the input ids of a batch, one line per text
+void write_batch(std::ofstream& ofs,
+    const std::vector<std::vector<int>>& input_ids,
+    size_t& num_tokens)
+{
+  for (size_t i = 0; i < input_ids.size(); i++)
+  {
+    num_tokens += input_ids[i].size();
+    if (!ofs.is_open())
+      continue;
+    for (size_t j = 0; j < input_ids[i].size(); j++)
+      ofs << (j ? " " : "") << input_ids[i][j];
+    ofs << '\n';
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  args::ArgumentParser parser("easytokenizer-cpp file encoding: read-encode-write loop vs StreamEncoder.");
+  args::HelpFlag help(parser, "help", "Show help information", {'h', "help"});
+  args::ValueFlag<std::string> vocabPath(
+      parser, "", "Tokenizer vocabulary file.", {"vocab_path"});
+  args::ValueFlag<std::string> sentPath(
+      parser, "", "Sentence data path to be processed.", {"sent_path"});
+  args::ValueFlag<std::string> outputPath(
+      parser, "", "Output path of the input ids, nothing is written if not given.", {"output_path"});
+  args::ValueFlag<int> numWorkers(
+      parser, "", "Number of tokenizer workers.", {"num_workers"});
+  args::ValueFlag<int> batchSize(
+      parser, "", "Batch size.", {"batch_size"});
+
+  // parse arguments
+  try
+  {
+    parser.ParseCLI(argc, argv);
+  }
+  catch (args::Help)
+  {
+    std::cerr << parser;
+    return 0;
+  }
+  catch (args::ParseError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+  catch (args::ValidationError e)
+  {
+    std::cerr << e.what() << std::endl;
+    std::cerr << parser;
+    std::exit(EXIT_FAILURE);
+  }
+
+  std::string vocab_path, sent_path, output_path;
+  int num_workers = 4;
+  int batch_size = 64;
+  if (vocabPath)
+    vocab_path = args::get(vocabPath);
+  if (sentPath)
+    sent_path = args::get(sentPath);
+  if (outputPath)
+    output_path = args::get(outputPath);
+  if (numWorkers)
+    num_workers = args::get(numWorkers);
+  if (batchSize)
+    batch_size = args::get(batchSize);
+  if (vocab_path.empty() || sent_path.empty())
+  {
+    std::cerr << parser;
+    throw std::invalid_argument("Get empty vocabulary/sentence file!");
+  }
+
+  tokenizer::Tokenizer AutoTokenizer(vocab_path, true, true);
+
+  // read, encode and write one batch after another
+  size_t num_lines = 0, num_tokens = 0;
+  std::ofstream ofs;
+  if (output_path.size())
+    ofs.open(output_path);
+  auto t0 = std::chrono::steady_clock::now();
+  {
+    std::ifstream ifs(sent_path);
+    if (!ifs.is_open())
+      throw std::invalid_argument(sent_path + " can not be opened for loading!");
+    std::string sentence;
+    std::vector<std::string> batch_sent_list;
+    std::vector<std::vector<int>> input_ids;
+    std::vector<std::vector<int>> attention_mask;
+    std::vector<std::vector<int>> offsets;
+    bool more = true;
+    while (more)
+    {
+      batch_sent_list.clear();
+      while (int(batch_sent_list.size()) < batch_size && (more = bool(std::getline(ifs, sentence))))
+        batch_sent_list.emplace_back(sentence);
+      if (batch_sent_list.empty())
+        break;
+      AutoTokenizer.encode(batch_sent_list, input_ids, attention_mask, offsets);
+      write_batch(ofs, input_ids, num_tokens);
+      num_lines += batch_sent_list.size();
+    }
+  }
+  if (ofs.is_open())
+    ofs.close();
+  auto t1 = std::chrono::steady_clock::now();
+
+  // pipelined reader, workers and writer
+  size_t stream_lines = 0, stream_tokens = 0, num_bytes = 0;
+  if (output_path.size())
+    ofs.open(output_path + ".stream");
+  {
+    tokenizer::StreamEncoder encoder(AutoTokenizer, sent_path, num_workers, batch_size);
+    stream_lines = encoder.run([&](const tokenizer::StreamBatch& batch)
+    {
+      write_batch(ofs, batch.input_ids, stream_tokens);
+    });
+    num_bytes = encoder.bytes_read();
+  }
+  if (ofs.is_open())
+    ofs.close();
+  auto t2 = std::chrono::steady_clock::now();
+
+  double loop_time = std::chrono::duration<double>(t1 - t0).count();
+  double stream_time = std::chrono::duration<double>(t2 - t1).count();
+  std::cout << "Number of lines: " << num_lines << "  bytes: " << num_bytes <<
+      "  tokens: " << num_tokens << "  batch_size: " << batch_size << std::endl;
+  std::cout << "read-encode-write loop   time: " << loop_time << "s  " <<
+      num_bytes / loop_time / 1e6 << " MB/s" << std::endl;
+  std::cout << "StreamEncoder (" << num_workers << " workers)  time: " << stream_time <<
+      "s  " << num_bytes / stream_time / 1e6 << " MB/s" << std::endl;
+  if (stream_lines != num_lines || stream_tokens != num_tokens)
+    std::cerr << "Output mismatch: " << stream_lines << " lines, " << stream_tokens <<
+        " tokens" << std::endl;
+
+  return 0;
+}
@@ -7,8 +7,10 @@
  */
 
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
 #include <pybind11/stl_bind.h>
 #include <pybind11/stl.h>
+#include <stream_encoder.h>
 #include <tokenizer.h>
 
 namespace py = pybind11;
@@ -19,8 +21,339 @@ using Encodings = std::map<std::string, std::vector<std::vector<int>>>;
 PYBIND11_MAKE_OPAQUE(Encoding);
 PYBIND11_MAKE_OPAQUE(Encodings);
 
+namespace
+{
+
+// DLPack tensor ABI, consumed by torch.utils.dlpack.from_dlpack
+struct DLDevice
+{
+  int32_t device_type;
+  int32_t device_id;
+};
+
+struct DLDataType
+{
+  uint8_t code;
+  uint8_t bits;
+  uint16_t lanes;
+};
+
+struct DLTensor
+{
+  void* data;
+  DLDevice device;
+  int32_t ndim;
+  DLDataType dtype;
+  int64_t* shape;
+  int64_t* strides;
+  uint64_t byte_offset;
+};
+
+struct DLManagedTensor
+{
+  DLTensor dl_tensor;
+  void* manager_ctx;
+  void (*deleter)(DLManagedTensor* self);
+};
+
+template <typename T>
+struct DLPackOwner
+{
+  std::vector<T> buffer;
+  std::vector<int64_t> shape;
+  DLManagedTensor tensor;
+};
+
+// buffer of an encoded batch as the exported element type
+template <typename T>
+std::vector<T> convert(std::vector<int>& buffer)
+{
+  return std::vector<T>(buffer.begin(), buffer.end());
+}
+
+template <>
+std::vector<int> convert<int>(std::vector<int>& buffer)
+{
+  return std::move(buffer);
+}
+
+// numpy array owning the buffer, without copy
+template <typename T>
+py::object to_numpy(std::vector<T>&& buffer, const std::vector<int64_t>& shape)
+{
+  auto owner = new std::vector<T>(std::move(buffer));
+  py::capsule base(owner, [](void* p) { delete static_cast<std::vector<T>*>(p); });
+  return py::array_t<T>(shape, owner->data(), base);
+}
+
+// DLPack capsule owning the buffer, without copy
+template <typename T>
+py::object to_dlpack(std::vector<T>&& buffer, const std::vector<int64_t>& shape)
+{
+  auto owner = new DLPackOwner<T>();
+  owner->buffer = std::move(buffer);
+  owner->shape = shape;
+  DLTensor& tensor = owner->tensor.dl_tensor;
+  tensor.data = owner->buffer.data();
+  tensor.device = {1, 0};  // kDLCPU
+  tensor.ndim = int32_t(shape.size());
+  tensor.dtype = {0, uint8_t(8 * sizeof(T)), 1};  // kDLInt
+  tensor.shape = owner->shape.data();
+  tensor.strides = nullptr;  // row-major
+  tensor.byte_offset = 0;
+  owner->tensor.manager_ctx = owner;
+  owner->tensor.deleter = [](DLManagedTensor* self)
+  {
+    delete static_cast<DLPackOwner<T>*>(self->manager_ctx);
+  };
+
+  // a consumer renames the capsule to used_dltensor and takes ownership
+  PyObject* capsule = PyCapsule_New(&owner->tensor, "dltensor", [](PyObject* capsule)
+  {
+    if (PyCapsule_IsValid(capsule, "used_dltensor"))
+      return;
+    auto self = static_cast<DLManagedTensor*>(PyCapsule_GetPointer(capsule, "dltensor"));
+    if (self)
+      self->deleter(self);
+  });
+  if (!capsule)
+  {
+    delete owner;
+    throw py::error_already_set();
+  }
+  return py::reinterpret_steal<py::object>(capsule);
+}
+
+// UTF-8 views of the texts of a batch, taken under the GIL without copying
+// and passed to the tokenizer as they are once the GIL is released
+struct TextViews
+{
+  std::vector<tokenizer::TextView> texts;
+  std::vector<py::object> owners;  // objects the views point into
+  std::vector<std::unique_ptr<py::buffer_info>> buffers;
+
+  void add(const char* ptr, size_t len)
+  { texts.emplace_back(ptr, len); }
+};
+
+// contiguous bytes of a str, bytes or 1-d buffer of single bytes
+void view_bytes(py::handle obj, TextViews& views, const char*& ptr, size_t& len)
+{
+  Py_ssize_t size = 0;
+  if (PyUnicode_Check(obj.ptr()))
+  {
+    ptr = PyUnicode_AsUTF8AndSize(obj.ptr(), &size);
+    if (!ptr)
+      throw py::error_already_set();
+  }
+  else if (PyBytes_Check(obj.ptr()))
+  {
+    char* data = nullptr;
+    if (PyBytes_AsStringAndSize(obj.ptr(), &data, &size))
+      throw py::error_already_set();
+    ptr = data;
+  }
+  else if (PyObject_CheckBuffer(obj.ptr()))
+  {
+    std::unique_ptr<py::buffer_info> info(new py::buffer_info(
+      py::reinterpret_borrow<py::buffer>(obj).request()));
+    if (info->ndim > 1 || info->itemsize != 1 || (info->ndim == 1 && info->strides[0] != 1))
+      throw py::type_error("text buffers must be contiguous bytes!");
+    ptr = static_cast<const char*>(info->ptr);
+    size = info->size;
+    views.buffers.emplace_back(std::move(info));
+  }
+  else
+    throw py::type_error("texts must be str, bytes or buffers of UTF-8 bytes!");
+  views.owners.emplace_back(py::reinterpret_borrow<py::object>(obj));
+  len = size;
+}
+
+// texts of a 1-d NumPy array of fixed width bytes ('S') or unicode ('U')
+void view_array(py::handle texts, TextViews& views)
+{
+  std::unique_ptr<py::buffer_info> info(new py::buffer_info(
+    py::reinterpret_borrow<py::buffer>(texts).request()));
+  char kind = info->format.empty() ? 0 : info->format.back();
+  if (info->ndim != 1 || (kind != 's' && kind != 'w'))
+    throw py::type_error("texts arrays must be 1-d arrays of bytes or str!");
+  const char* base = static_cast<const char*>(info->ptr);
+  size_t width = info->itemsize;
+  for (Py_ssize_t i = 0; i < info->shape[0]; i++)
+  {
+    const char* item = base + i * info->strides[0];
+    if (kind == 's')
+    {
+      // items are padded with NUL bytes
+      size_t len = width;
+      while (len > 0 && item[len - 1] == '\0')
+        len--;
+      views.add(item, len);
+      continue;
+    }
+
+    // UCS4 items have no UTF-8 representation to point into
+    Py_ssize_t len = width / 4;
+    const Py_UCS4* codes = reinterpret_cast<const Py_UCS4*>(item);
+    while (len > 0 && codes[len - 1] == 0)
+      len--;
+    py::object text = py::reinterpret_steal<py::object>(
+      PyUnicode_FromKindAndData(PyUnicode_4BYTE_KIND, codes, len));
+    if (!text)
+      throw py::error_already_set();
+    const char* ptr = nullptr;
+    size_t size = 0;
+    view_bytes(text, views, ptr, size);
+    views.add(ptr, size);
+  }
+  views.owners.emplace_back(py::reinterpret_borrow<py::object>(texts));
+  views.buffers.emplace_back(std::move(info));
+}
+
+// texts of a sequence of str, bytes or buffers, or of a NumPy array
+void view_texts(py::handle texts, TextViews& views)
+{
+  if (PyUnicode_Check(texts.ptr()) || PyBytes_Check(texts.ptr()))
+    throw py::type_error("texts must be a sequence, pass text_offsets to split a buffer!");
+  if (PyObject_CheckBuffer(texts.ptr()))
+  {
+    view_array(texts, views);
+    return;
+  }
+  py::object seq = py::reinterpret_steal<py::object>(
+    PySequence_Fast(texts.ptr(), "texts must be a sequence of str!"));
+  if (!seq)
+    throw py::error_already_set();
+  Py_ssize_t n = PySequence_Fast_GET_SIZE(seq.ptr());
+  PyObject** items = PySequence_Fast_ITEMS(seq.ptr());
+  views.texts.reserve(n);
+  views.owners.reserve(n);
+  for (Py_ssize_t i = 0; i < n; i++)
+  {
+    const char* ptr = nullptr;
+    size_t size = 0;
+    view_bytes(items[i], views, ptr, size);
+    views.add(ptr, size);
+  }
+}
+
+// texts at byte offsets [offsets[i], offsets[i + 1]) of one concatenated buffer
+void view_concatenated(py::handle data, py::handle offsets, TextViews& views)
+{
+  const char* base = nullptr;
+  size_t size = 0;
+  view_bytes(data, views, base, size);
+
+  std::vector<int64_t> bounds;
+  if (PyObject_CheckBuffer(offsets.ptr()))
+  {
+    py::buffer_info info = py::reinterpret_borrow<py::buffer>(offsets).request();
+    char kind = info.format.empty() ? 0 : info.format.back();
+    if (info.ndim != 1 || (info.itemsize != 4 && info.itemsize != 8) ||
+        std::string("iIlLqQ").find(kind) == std::string::npos)
+      throw py::type_error("text_offsets must be a 1-d array of int32 or int64!");
+    const char* ptr = static_cast<const char*>(info.ptr);
+    for (Py_ssize_t i = 0; i < info.shape[0]; i++)
+    {
+      const char* item = ptr + i * info.strides[0];
+      bounds.emplace_back(info.itemsize == 4 ? int64_t(*reinterpret_cast<const int32_t*>(item)) :
+        *reinterpret_cast<const int64_t*>(item));
+    }
+  }
+  else
+    bounds = offsets.cast<std::vector<int64_t>>();
+
+  if (bounds.empty())
+    throw std::invalid_argument("text_offsets must hold number of texts + 1 offsets!");
+  for (size_t i = 0; i + 1 < bounds.size(); i++)
+  {
+    if (bounds[i] < 0 || bounds[i] > bounds[i + 1] || size_t(bounds[i + 1]) > size)
+      throw std::invalid_argument("text_offsets must be increasing offsets into the buffer!");
+    views.add(base + bounds[i], bounds[i + 1] - bounds[i]);
+  }
+}
+
+// dict of [batch_size, seq_len] tensors of an encoded batch
+template <typename T>
+py::dict to_tensors(tokenizer::BatchEncoding& encoding, bool dlpack)
+{
+  std::vector<T> input_ids, attention_mask, offsets;
+  {
+    py::gil_scoped_release release;
+    input_ids = convert<T>(encoding.input_ids);
+    attention_mask = convert<T>(encoding.attention_mask);
+    offsets = convert<T>(encoding.offsets);
+  }
+  std::vector<int64_t> shape = {encoding.batch_size, encoding.seq_len};
+  std::vector<int64_t> offsets_shape = {encoding.batch_size, encoding.seq_len, 2};
+  py::object (*export_buffer)(std::vector<T>&&, const std::vector<int64_t>&) = to_numpy<T>;
+  if (dlpack)
+    export_buffer = to_dlpack<T>;
+
+  py::dict tensors;
+  tensors["input_ids"] = export_buffer(std::move(input_ids), shape);
+  tensors["attention_mask"] = export_buffer(std::move(attention_mask), shape);
+  tensors["offsets"] = export_buffer(std::move(offsets), offsets_shape);
+  return tensors;
+}
+
+void check_tensors(const std::string& return_tensors, const std::string& dtype, bool padding)
+{
+  if (return_tensors.empty())
+    return;
+  if (return_tensors != "np" && return_tensors != "dlpack")
+    throw std::invalid_argument("return_tensors must be one of '', 'np' and 'dlpack'!");
+  if (dtype != "int32" && dtype != "int64")
+    throw std::invalid_argument("dtype must be one of 'int32' and 'int64'!");
+  if (!padding)
+    throw std::invalid_argument("return_tensors requires padding!");
+}
+
+py::dict to_tensors(tokenizer::BatchEncoding& encoding, const std::string& return_tensors,
+    const std::string& dtype)
+{
+  bool dlpack = return_tensors == "dlpack";
+  if (dtype == "int64")
+    return to_tensors<int64_t>(encoding, dlpack);
+  return to_tensors<int>(encoding, dlpack);
+}
+
+// Python iterator over the encoded batches of a file
+struct FileEncoder
+{
+  std::unique_ptr<tokenizer::StreamEncoder> encoder;
+  std::string return_tensors;
+  std::string dtype;
+  std::mutex mutex;  // next() of the encoder is not thread-safe
+};
+
+// padded rows of a stream batch as row-major buffers
+void flatten(tokenizer::StreamBatch& batch, tokenizer::BatchEncoding& encoding)
+{
+  int n = batch.input_ids.size();
+  int seq_len = n > 0 ? batch.input_ids[0].size() : 0;
+  encoding.batch_size = n;
+  encoding.seq_len = seq_len;
+  encoding.input_ids.resize(size_t(n) * seq_len);
+  encoding.attention_mask.resize(size_t(n) * seq_len);
+  encoding.offsets.assign(size_t(n) * 2 * seq_len, 0);
+  for (int i = 0; i < n; i++)
+  {
+    size_t row = size_t(i) * seq_len;
+    std::copy(batch.input_ids[i].begin(), batch.input_ids[i].end(),
+      encoding.input_ids.begin() + row);
+    std::copy(batch.attention_mask[i].begin(), batch.attention_mask[i].end(),
+      encoding.attention_mask.begin() + row);
+    std::copy(batch.offsets[i].begin(), batch.offsets[i].end(),
+      encoding.offsets.begin() + 2 * row);
+  }
+}
+
+}
+
 PYBIND11_MODULE(easytokenizer, m) {
   m.doc() = "An efficient and easy-to-use tokenization toolkit.";
+  m.attr("AUTO_THREADS") = tokenizer::AUTO_THREADS;
   
   py::bind_map<Encoding>(m, "Encoding");  
   py::bind_map<Encodings>(m, "Encodings"); 
@@ -32,6 +365,33 @@ PYBIND11_MODULE(easytokenizer, m) {
     .def(py::init<const std::string&, bool, bool>(), "Init AutoTokenizer",
          py::arg("vocab_path"), py::arg("do_lower_case") = true,
          py::arg("codepoint_level") = true)
+
+    // tokenizers opened from a saved file are pickled as the path and
+    // mapped again, others as their binary form
+    .def(py::pickle(
+      [](const tokenizer::Tokenizer& m) {
+        if (m.path().size())
+          return py::make_tuple(m.path(), py::bytes());
+        return py::make_tuple(std::string(), py::bytes(m.serialize()));
+      },
+      [](py::tuple state) {
+        if (state.size() != 2)
+          throw std::invalid_argument("invalid AutoTokenizer state!");
+        std::string path = state[0].cast<std::string>();
+        if (path.size())
+          return tokenizer::Tokenizer::open(path);
+        return tokenizer::Tokenizer::deserialize(state[1].cast<std::string>());
+      }
+    ))
+    .def("save", &tokenizer::Tokenizer::save, py::arg("path"))
+    .def_static("open", &tokenizer::Tokenizer::open, py::arg("path"))
+    .def("path", &tokenizer::Tokenizer::path)
+    .def("serialize", [](const tokenizer::Tokenizer& m) { return py::bytes(m.serialize()); })
+    .def_static(
+      "deserialize",
+      [](const std::string& data) { return tokenizer::Tokenizer::deserialize(data); },
+      py::arg("data")
+    )
     
     .def("insert", (void (tokenizer::Tokenizer::*)(const std::string&))
         (&tokenizer::Tokenizer::insert), py::arg("token"))
@@ -58,15 +418,126 @@ PYBIND11_MODULE(easytokenizer, m) {
     .def("unk_id", &tokenizer::Tokenizer::unk_id)
     .def("mask_id", &tokenizer::Tokenizer::mask_id)
     .def("get_id", &tokenizer::Tokenizer::get_id, py::arg("token"))
+
+    .def("set_thread_pool", (void (tokenizer::Tokenizer::*)(int, bool, size_t))
+        (&tokenizer::Tokenizer::set_thread_pool), 
+        py::arg("max_threads"), py::arg("pin_threads") = false,
+        py::arg("queue_capacity") = 1024)
+
+    .def("set_cache", &tokenizer::Tokenizer::set_cache,
+        py::arg("capacity"), py::arg("num_shards") = 16)
+    .def(
+      "cache_stats",
+      [](tokenizer::Tokenizer& m) {
+        tokenizer::CacheStats stats = m.cache_stats();
+        py::dict result;
+        result["hits"] = stats.hits;
+        result["misses"] = stats.misses;
+        result["evictions"] = stats.evictions;
+        result["duplicates"] = stats.duplicates;
+        result["size"] = stats.size;
+        result["bytes"] = stats.bytes;
+        result["hit_rate"] = stats.hit_rate();
+        return result;
+      }
+    )
+    .def(
+      "stats",
+      [](tokenizer::Tokenizer& m) {
+        tokenizer::PipelineStats stats = m.stats();
+        py::dict result;
+        result["enabled"] = stats.enabled;
+        for (int c = 0; c < tokenizer::NUM_STATS_COUNTERS; c++)
+          result[tokenizer::PipelineStats::counter_name(c)] = stats.counters[c];
+        result["unk_rate"] = stats.unk_rate();
+        py::dict stages;
+        for (int s = 0; s < tokenizer::NUM_STATS_STAGES; s++)
+        {
+          const tokenizer::LatencyHistogram& h = stats.stages[s];
+          py::dict stage;
+          stage["count"] = h.count;
+          stage["mean_ns"] = h.mean_ns();
+          stage["p50_ns"] = h.percentile(0.5);
+          stage["p99_ns"] = h.percentile(0.99);
+          stage["p999_ns"] = h.percentile(0.999);
+          stage["buckets"] = std::vector<size_t>(h.buckets, 
+            h.buckets + tokenizer::LatencyHistogram::num_buckets);
+          stages[tokenizer::PipelineStats::stage_name(s)] = stage;
+        }
+        result["stages"] = stages;
+        return result;
+      }
+    )
+    .def("reset_stats", &tokenizer::Tokenizer::reset_stats)
+    .def(
+      "memory_usage",
+      [](tokenizer::Tokenizer& m) {
+        tokenizer::MemoryUsage usage = m.memory_usage();
+        auto trie = [](const cedar::TrieMemory& memory) {
+          py::dict result;
+          result["nodes"] = memory.nodes;
+          result["node_capacity"] = memory.node_capacity;
+          result["array_used"] = memory.array_used;
+          result["array_allocated"] = memory.array_allocated;
+          result["ninfo_used"] = memory.ninfo_used;
+          result["ninfo_allocated"] = memory.ninfo_allocated;
+          result["block_used"] = memory.block_used;
+          result["block_allocated"] = memory.block_allocated;
+          result["keys"] = memory.keys;
+          result["mapped"] = memory.mapped;
+          result["allocated"] = memory.allocated();
+          return result;
+        };
+        py::dict result;
+        result["vocab"] = trie(usage.vocab);
+        result["special"] = trie(usage.special);
+        result["char_ids"] = usage.char_ids;
+        result["cache"] = usage.cache;
+        result["cache_entries"] = usage.cache_entries;
+        result["workspaces"] = usage.workspaces;
+        result["num_workspaces"] = usage.num_workspaces;
+        result["total"] = usage.total();
+        return result;
+      }
+    )
     
     .def("convert_ids_to_tokens", &tokenizer::Tokenizer::convert_ids_to_tokens, 
-         py::arg("input_ids"))
+         py::arg("input_ids"), py::call_guard<py::gil_scoped_release>())
     .def(
       "convert_tokens_to_ids",
       [](tokenizer::Tokenizer& m, const std::vector<std::string>& tokens, bool add_cls_sep = false) {
         return m.convert_tokens_to_ids(tokens, add_cls_sep);
       },
-      py::arg("tokens"), py::arg("add_cls_sep") = false
+      py::arg("tokens"), py::arg("add_cls_sep") = false,
+      py::call_guard<py::gil_scoped_release>()
+    )
+    
+    .def(
+      "decode",
+      [](tokenizer::Tokenizer& m, const std::vector<int>& input_ids,
+        bool skip_special_tokens = true, bool clean_up_tokenization_spaces = true) {
+        return m.decode(input_ids, skip_special_tokens, clean_up_tokenization_spaces);
+      },
+      py::arg("input_ids"),
+      py::arg("skip_special_tokens") = true,
+      py::arg("clean_up_tokenization_spaces") = true,
+      py::call_guard<py::gil_scoped_release>()
+    )
+    .def(
+      "batch_decode",
+      [](tokenizer::Tokenizer& m, const std::vector<std::vector<int>>& input_ids,
+        int num_threads = 1, bool skip_special_tokens = true, 
+        bool clean_up_tokenization_spaces = true) {
+        std::vector<std::string> texts;
+        m.batch_decode(input_ids, texts, num_threads, skip_special_tokens, 
+          clean_up_tokenization_spaces);
+        return texts;
+      },
+      py::arg("input_ids"),
+      py::arg("num_threads") = 1,
+      py::arg("skip_special_tokens") = true,
+      py::arg("clean_up_tokenization_spaces") = true,
+      py::call_guard<py::gil_scoped_release>()
     )
     
     .def(
@@ -74,7 +545,80 @@ PYBIND11_MODULE(easytokenizer, m) {
       [](tokenizer::Tokenizer& m, const std::string& text) {
         return m.wordpiece_tokenize(text);       
       },
-      py::arg("text")
+      py::arg("text"),
+      py::call_guard<py::gil_scoped_release>()
+    )
+
+    .def(
+      "batch_tokenize",
+      [](tokenizer::Tokenizer& m, const std::vector<std::string>& texts, int num_threads = 1) {
+        std::vector<std::string> tokens;
+        std::vector<size_t> row_offsets;
+        {
+          py::gil_scoped_release release;
+          m.batch_tokenize(texts, tokens, row_offsets, num_threads);
+        }
+
+        py::dict result;
+        result["tokens"] = std::move(tokens);
+        result["row_offsets"] = std::move(row_offsets);
+        return result;
+      },
+      py::arg("texts"),
+      py::arg("num_threads") = 1
+    )
+    .def(
+      "batch_convert_ids_to_tokens",
+      [](tokenizer::Tokenizer& m, const std::vector<std::vector<int>>& input_ids,
+        int num_threads = 1) {
+        std::vector<std::string> tokens;
+        std::vector<size_t> row_offsets;
+        {
+          py::gil_scoped_release release;
+          m.batch_convert_ids_to_tokens(input_ids, tokens, row_offsets, num_threads);
+        }
+
+        py::dict result;
+        result["tokens"] = std::move(tokens);
+        result["row_offsets"] = std::move(row_offsets);
+        return result;
+      },
+      py::arg("input_ids"),
+      py::arg("num_threads") = 1
+    )
+    .def(
+      "batch_convert_tokens_to_ids",
+      [](tokenizer::Tokenizer& m, const std::vector<std::vector<std::string>>& tokens,
+        int num_threads = 1, bool add_cls_sep = false) {
+        std::vector<int> input_ids;
+        std::vector<size_t> row_offsets;
+        {
+          py::gil_scoped_release release;
+          m.batch_convert_tokens_to_ids(tokens, input_ids, row_offsets, num_threads,
+            add_cls_sep);
+        }
+
+        py::dict result;
+        result["input_ids"] = std::move(input_ids);
+        result["row_offsets"] = std::move(row_offsets);
+        return result;
+      },
+      py::arg("tokens"),
+      py::arg("num_threads") = 1,
+      py::arg("add_cls_sep") = false
+    )
+    .def(
+      "count_tokens",
+      [](tokenizer::Tokenizer& m, const std::vector<std::string>& texts,
+        int num_threads = 1, bool add_cls_sep = false) {
+        std::vector<int> counts;
+        m.count_tokens(texts, counts, num_threads, add_cls_sep);
+        return counts;
+      },
+      py::arg("texts"),
+      py::arg("num_threads") = 1,
+      py::arg("add_cls_sep") = false,
+      py::call_guard<py::gil_scoped_release>()
     )
     
     .def(
@@ -96,32 +640,276 @@ PYBIND11_MODULE(easytokenizer, m) {
       py::arg("text"),
       py::arg("add_cls_sep") = true,
       py::arg("truncation") = true, 
-      py::arg("max_length") = 512
+      py::arg("max_length") = 512,
+      py::call_guard<py::gil_scoped_release>()
     )
     
+    .def(
+      "encode_parallel",
+      [](tokenizer::Tokenizer& m, const std::string& text, int num_threads,
+        bool add_cls_sep = true, bool truncation = true, int max_length = 512) {
+        std::vector<int> input_ids;
+        std::vector<int> attention_mask;
+        std::vector<int> offsets;
+        m.encode_parallel(text, input_ids, attention_mask, offsets, num_threads,
+          add_cls_sep, truncation, max_length);
+
+        Encoding encoding;
+        encoding["input_ids"] = std::move(input_ids);
+        encoding["attention_mask"] = std::move(attention_mask);
+        encoding["offsets"] = std::move(offsets);
+        return encoding;
+      },
+      py::arg("text"),
+      py::arg("num_threads"),
+      py::arg("add_cls_sep") = true,
+      py::arg("truncation") = true,
+      py::arg("max_length") = 512,
+      py::call_guard<py::gil_scoped_release>()
+    )
+
     .def(
       "encode",
-      [](tokenizer::Tokenizer& m, const std::vector<std::string>& texts, int num_threads = 1, 
+      [](tokenizer::Tokenizer& m, py::object texts, int num_threads = 1, 
         bool add_cls_sep = true, bool padding = true, bool padding_to_max_length = false, 
-        bool truncation = true, int max_length = 512) {
+        bool truncation = true, int max_length = 512, const std::string& return_tensors = "",
+        const std::string& dtype = "int32", py::object text_offsets = py::none()) -> py::object {
+        TextViews views;
+        if (text_offsets.is_none())
+          view_texts(texts, views);
+        else
+          view_concatenated(texts, text_offsets, views);
+
+        if (return_tensors.empty())
+        {
+          Encodings encodings;
+          {
+            py::gil_scoped_release release;
+            std::vector<std::vector<int>> input_ids;
+            std::vector<std::vector<int>> attention_mask;
+            std::vector<std::vector<int>> offsets;
+            m.encode(views.texts, input_ids, attention_mask, offsets, num_threads, add_cls_sep, padding, 
+              padding_to_max_length, truncation, max_length);
+            encodings["input_ids"] = std::move(input_ids);
+            encodings["attention_mask"] = std::move(attention_mask);
+            encodings["offsets"] = std::move(offsets);
+          }
+          return py::cast(std::move(encodings));
+        }
+
+        check_tensors(return_tensors, dtype, padding);
+        tokenizer::BatchEncoding encoding;
+        {
+          py::gil_scoped_release release;
+          m.encode_batch_into(views.texts, encoding, num_threads, add_cls_sep, 
+            padding_to_max_length, truncation, max_length);
+        }
+        return to_tensors(encoding, return_tensors, dtype);
+      },
+      py::arg("texts"),
+      py::arg("num_threads") = 1,
+      py::arg("add_cls_sep") = true, 
+      py::arg("padding") = true,
+      py::arg("padding_to_max_length") = false, 
+      py::arg("truncation") = true,
+      py::arg("max_length") = 512,
+      py::arg("return_tensors") = "",
+      py::arg("dtype") = "int32",
+      py::arg("text_offsets") = py::none()
+    )
+
+    // overflowing windows have their own name, a positional int of encode
+    // is num_threads
+    .def(
+      "encode_windows",
+      [](tokenizer::Tokenizer& m, const std::string& text, int stride,
+        bool add_cls_sep = true, int max_length = 512) {
         std::vector<std::vector<int>> input_ids;
         std::vector<std::vector<int>> attention_mask;
         std::vector<std::vector<int>> offsets;
-        m.encode(texts, input_ids, attention_mask, offsets, num_threads, add_cls_sep, padding, 
-          padding_to_max_length, truncation, max_length);
+        {
+          py::gil_scoped_release release;
+          m.encode(text, input_ids, attention_mask, offsets, stride, 
+            add_cls_sep, max_length);
+        }
 
-        Encodings encodings;
+        py::dict encodings;
         encodings["input_ids"] = std::move(input_ids);
         encodings["attention_mask"] = std::move(attention_mask);
         encodings["offsets"] = std::move(offsets);
-        return encodings;       
+        return encodings;
+      },
+      py::arg("text"),
+      py::arg("stride"),
+      py::arg("add_cls_sep") = true,
+      py::arg("max_length") = 512
+    )
+
+    .def(
+      "encode_windows",
+      [](tokenizer::Tokenizer& m, const std::vector<std::string>& texts, int stride,
+        int num_threads = 1, bool add_cls_sep = true, bool padding = true, 
+        bool padding_to_max_length = false, int max_length = 512) {
+        std::vector<std::vector<int>> input_ids;
+        std::vector<std::vector<int>> attention_mask;
+        std::vector<std::vector<int>> offsets;
+        std::vector<int> overflow_to_sample;
+        {
+          py::gil_scoped_release release;
+          m.encode(texts, input_ids, attention_mask, offsets, overflow_to_sample, stride,
+            num_threads, add_cls_sep, padding, padding_to_max_length, max_length);
+        }
+
+        py::dict encodings;
+        encodings["input_ids"] = std::move(input_ids);
+        encodings["attention_mask"] = std::move(attention_mask);
+        encodings["offsets"] = std::move(offsets);
+        encodings["overflow_to_sample_mapping"] = std::move(overflow_to_sample);
+        return encodings;
       },
       py::arg("texts"),
+      py::arg("stride"),
       py::arg("num_threads") = 1,
-      py::arg("add_cls_sep") = true, 
+      py::arg("add_cls_sep") = true,
       py::arg("padding") = true,
-      py::arg("padding_to_max_length") = false, 
+      py::arg("padding_to_max_length") = false,
+      py::arg("max_length") = 512
+    )
+
+    .def(
+      "encode_with_timeout",
+      [](tokenizer::Tokenizer& m, const std::vector<std::string>& texts, double timeout,
+        int num_threads = 1, bool add_cls_sep = true, bool padding = true,
+        bool padding_to_max_length = false, bool truncation = true, int max_length = 512) {
+        std::vector<std::vector<int>> input_ids;
+        std::vector<std::vector<int>> attention_mask;
+        std::vector<std::vector<int>> offsets;
+        std::vector<int> completed;
+        auto cancel = tokenizer::CancelToken::after(
+          std::chrono::duration_cast<tokenizer::CancelToken::Clock::duration>(
+            std::chrono::duration<double>(timeout)));
+        {
+          py::gil_scoped_release release;
+          m.encode(texts, input_ids, attention_mask, offsets, completed, cancel,
+            num_threads, add_cls_sep, padding, padding_to_max_length, truncation, max_length);
+        }
+
+        py::dict encodings;
+        encodings["input_ids"] = std::move(input_ids);
+        encodings["attention_mask"] = std::move(attention_mask);
+        encodings["offsets"] = std::move(offsets);
+        encodings["completed"] = std::move(completed);
+        return encodings;
+      },
+      py::arg("texts"),
+      py::arg("timeout"),
+      py::arg("num_threads") = 1,
+      py::arg("add_cls_sep") = true,
+      py::arg("padding") = true,
+      py::arg("padding_to_max_length") = false,
+      py::arg("truncation") = true,
+      py::arg("max_length") = 512
+    )
+
+    .def(
+      "encode_buckets",
+      [](tokenizer::Tokenizer& m, const std::vector<std::string>& texts, int batch_size,
+        int max_tokens = 0, int num_threads = 1, bool add_cls_sep = true, 
+        bool truncation = true, int max_length = 512) {
+        std::vector<tokenizer::Bucket> buckets;
+        {
+          py::gil_scoped_release release;
+          m.encode_buckets(texts, buckets, batch_size, max_tokens, num_threads, 
+            add_cls_sep, truncation, max_length);
+        }
+
+        py::list result;
+        for (auto& bucket : buckets)
+        {
+          py::dict encodings;
+          encodings["indices"] = std::move(bucket.indices);
+          encodings["input_ids"] = std::move(bucket.input_ids);
+          encodings["attention_mask"] = std::move(bucket.attention_mask);
+          encodings["offsets"] = std::move(bucket.offsets);
+          result.append(encodings);
+        }
+        return result;
+      },
+      py::arg("texts"),
+      py::arg("batch_size"),
+      py::arg("max_tokens") = 0,
+      py::arg("num_threads") = 1,
+      py::arg("add_cls_sep") = true,
       py::arg("truncation") = true,
       py::arg("max_length") = 512
+    )
+
+    .def(
+      "encode_file",
+      [](tokenizer::Tokenizer& m, const std::string& path, int batch_size = 64,
+        int num_threads = 1, int max_in_flight = 0, bool add_cls_sep = true,
+        bool padding = true, bool truncation = true, int max_length = 512,
+        const std::string& return_tensors = "", const std::string& dtype = "int32") {
+        check_tensors(return_tensors, dtype, padding);
+        std::unique_ptr<FileEncoder> it(new FileEncoder());
+        it->encoder.reset(new tokenizer::StreamEncoder(m, path, num_threads, batch_size,
+          max_in_flight, add_cls_sep, padding, truncation, max_length));
+        it->return_tensors = return_tensors;
+        it->dtype = dtype;
+        return it.release();
+      },
+      py::arg("path"),
+      py::arg("batch_size") = 64,
+      py::arg("num_threads") = 1,
+      py::arg("max_in_flight") = 0,
+      py::arg("add_cls_sep") = true,
+      py::arg("padding") = true,
+      py::arg("truncation") = true,
+      py::arg("max_length") = 512,
+      py::arg("return_tensors") = "",
+      py::arg("dtype") = "int32",
+      py::return_value_policy::take_ownership,
+      py::keep_alive<0, 1>()
     );
+
+  py::class_<FileEncoder>(m, "FileEncoder")
+    .def("__iter__", [](FileEncoder& it) -> FileEncoder& { return it; })
+    .def(
+      "__next__",
+      [](FileEncoder& it) -> py::object {
+        tokenizer::StreamBatch batch;
+        tokenizer::BatchEncoding encoding;
+        bool more = false;
+        {
+          py::gil_scoped_release release;
+          std::lock_guard<std::mutex> lock(it.mutex);
+          more = it.encoder->next(batch);
+          if (more && it.return_tensors.size())
+            flatten(batch, encoding);
+        }
+        if (!more)
+          throw py::stop_iteration();
+
+        py::dict result;
+        if (it.return_tensors.size())
+          result = to_tensors(encoding, it.return_tensors, it.dtype);
+        else
+        {
+          result["input_ids"] = std::move(batch.input_ids);
+          result["attention_mask"] = std::move(batch.attention_mask);
+          result["offsets"] = std::move(batch.offsets);
+        }
+        result["first_line"] = batch.first_line;
+        return result;
+      }
+    )
+    .def("bytes_read", [](FileEncoder& it) { return it.encoder->bytes_read(); });
+
+  py::class_<tokenizer::DecodeStream>(m, "DecodeStream")
+    .def(py::init<const tokenizer::Tokenizer&, bool, bool>(), "Init DecodeStream",
+         py::arg("tokenizer"), py::arg("skip_special_tokens") = true,
+         py::arg("clean_up_tokenization_spaces") = true, py::keep_alive<1, 2>())
+    .def("step", (std::string (tokenizer::DecodeStream::*)(int))
+        (&tokenizer::DecodeStream::step), py::arg("id"))
+    .def("reset", &tokenizer::DecodeStream::reset);
 }
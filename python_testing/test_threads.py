@@ -0,0 +1,61 @@
+# coding=utf-8
+# author: wangzejun (wangzejunscut@126.com)
+
+import argparse
+import threading
+import time
+from easytokenizer import AutoTokenizer as OurTokenizer
+
+def main(args):
+    sent_list = []
+    with open(args.data_path, mode="r", encoding="utf-8") as data_handle:
+        for line in data_handle:
+            line = line.strip()
+            if line:
+                sent_list.append(line)
+
+    our_tokenizer = OurTokenizer(args.vocab_path, do_lower_case=args.do_lower_case)
+
+    num_batches = int((len(sent_list) - 1) / args.batch_size) + 1
+    batches = []
+    for i in range(num_batches):
+        start = i * args.batch_size
+        end = min((i + 1) * args.batch_size, len(sent_list))
+        batches.append(sent_list[start: end])
+
+    # one thread encodes all batches
+    t_s = time.time()
+    for batch_sent_list in batches:
+        our_tokenizer.encode(batch_sent_list)
+    t_e = time.time()
+    single_time_usage = t_e - t_s
+
+    # num_threads python threads encode interleaved batches concurrently
+    def worker(k):
+        for i in range(k, num_batches, args.num_threads):
+            our_tokenizer.encode(batches[i])
+
+    threads = [threading.Thread(target=worker, args=(k,)) for k in range(args.num_threads)]
+    t_s = time.time()
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    t_e = time.time()
+    multi_time_usage = t_e - t_s
+
+    print("number of sentences: {}  batch size: {}".format(len(sent_list), args.batch_size))
+    print("1 python thread time usage: {}s".format(single_time_usage))
+    print("{} python threads time usage: {}s".format(args.num_threads, multi_time_usage))
+    print("speedup: {:.2f}x".format(single_time_usage / multi_time_usage))
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--vocab_path", required=True, type=str)
+    parser.add_argument("--data_path", required=True, type=str)
+    parser.add_argument("--num_threads", type=int, default=8)
+    parser.add_argument("--batch_size", type=int, default=32)
+    parser.add_argument("--do_lower_case", action="store_true")
+    args = parser.parse_args()
+
+    main(args)
@@ -60,6 +60,8 @@ ext_modules = [
             EASYTOKENIZER_SRC,
         ],
         language="c++",
+        # WITH_STATS=1 in the environment records pipeline statistics
+        define_macros=[("WITH_STATS", None)] if os.environ.get("WITH_STATS") == "1" else [],
         extra_compile_args=["-O3", "-march=native", "-funroll-loops"]
     ),
 ]
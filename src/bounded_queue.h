@@ -0,0 +1,143 @@
+/**
+ * Copyright (c) 2022-present, Zejun Wang (wangzejunscut@126.com)
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+namespace tokenizer
+{
+
+// lock-free bounded multi-producer multi-consumer queue, each cell
+// carries a sequence number telling whether it is ready to be written
+// or read at the current position (Dmitry Vyukov's design)
+template <typename T>
+class BoundedQueue
+{
+  public:
+    // capacity is rounded up to a power of two
+    explicit BoundedQueue(size_t capacity)
+    {
+      size_t size = 2;
+      while (size < capacity)
+        size <<= 1;
+      _mask = size - 1;
+      _cells = std::unique_ptr<Cell[]>(new Cell[size]);
+      for (size_t i = 0; i < size; i++)
+        _cells[i].sequence.store(i, std::memory_order_relaxed);
+      _enqueue_pos.store(0, std::memory_order_relaxed);
+      _dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    size_t capacity() const
+    { return _mask + 1; }
+
+    // move value into the queue, false if it is full
+    bool try_push(T& value)
+    {
+      Cell* cell = nullptr;
+      size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+      while (true)
+      {
+        cell = &_cells[pos & _mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = intptr_t(seq) - intptr_t(pos);
+        if (diff == 0)
+        {
+          if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            break;
+        }
+        else if (diff < 0)
+          return false;
+        else
+          pos = _enqueue_pos.load(std::memory_order_relaxed);
+      }
+      cell->data = std::move(value);
+      cell->sequence.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    // move the oldest value out of the queue, false if it is empty
+    bool try_pop(T& value)
+    {
+      Cell* cell = nullptr;
+      size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+      while (true)
+      {
+        cell = &_cells[pos & _mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+        if (diff == 0)
+        {
+          if (_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            break;
+        }
+        else if (diff < 0)
+          return false;
+        else
+          pos = _dequeue_pos.load(std::memory_order_relaxed);
+      }
+      value = std::move(cell->data);
+      cell->sequence.store(pos + _mask + 1, std::memory_order_release);
+      return true;
+    }
+
+  private:
+    struct Cell
+    {
+      std::atomic<size_t> sequence;
+      T data;
+    };
+
+    // producers and consumers update their positions on separate lines
+    static const size_t _cache_line = 64;
+
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+    char _pad0[_cache_line];
+    std::atomic<size_t> _enqueue_pos;
+    char _pad1[_cache_line];
+    std::atomic<size_t> _dequeue_pos;
+    char _pad2[_cache_line];
+};
+
+// waiting strategy of the threads around lock-free queues: spin shortly,
+// then yield, then sleep
+class Backoff
+{
+  public:
+    Backoff() : _spins(0) {}
+
+    void wait()
+    {
+      _spins++;
+      if (_spins < 64)
+        return;
+      if (_spins < 256)
+        std::this_thread::yield();
+      else
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    void reset()
+    { _spins = 0; }
+
+  private:
+    int _spins;
+};
+
+}
+#endif
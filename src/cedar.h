@@ -73,6 +73,14 @@ namespace cedar {
     size_t size       () const { return static_cast <size_t> (_size); }
     size_t total_size () const { return sizeof (node) * _size; }
     size_t unit_size  () const { return sizeof (node); }
+    // allocated elements of the update information, 0 until restored
+    size_t ninfo_capacity () const
+    { return _ninfo ? static_cast <size_t> (_capacity > _size ? _capacity : _size) : 0; }
+    size_t block_capacity () const
+    { return _block ? static_cast <size_t> (_capacity > _size ? _capacity : _size) >> 8 : 0; }
+    size_t ninfo_unit_size () const { return sizeof (ninfo); }
+    size_t block_unit_size () const { return sizeof (block); }
+    bool   owns_array () const { return ! _no_delete; }
     size_t nonzero_size () const {
       size_t i = 0;
       for (int to = 0; to < _size; ++to)
@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) 2022-present, Zejun Wang (wangzejunscut@126.com)
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef COUNTING_ALLOCATOR_H
+#define COUNTING_ALLOCATOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace tokenizer
+{
+
+// bytes currently allocated through the allocators sharing the counter
+struct AllocationCounter
+{
+  std::atomic<size_t> bytes;
+
+  AllocationCounter() : bytes(0) {}
+  AllocationCounter(const AllocationCounter&) = delete;
+  AllocationCounter& operator=(const AllocationCounter&) = delete;
+
+  size_t get() const
+  { return bytes.load(std::memory_order_relaxed); }
+};
+
+// std::allocator that adds its allocations to a counter, if any; the
+// counter must outlive the memory allocated with it
+template <typename T>
+class CountingAllocator
+{
+  public:
+    using value_type = T;
+
+    CountingAllocator(AllocationCounter* counter = nullptr) : _counter(counter) {}
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>& other) : _counter(other.counter()) {}
+
+    T* allocate(size_t n)
+    {
+      T* p = std::allocator<T>().allocate(n);
+      if (_counter)
+        _counter->bytes.fetch_add(n * sizeof(T), std::memory_order_relaxed);
+      return p;
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+      if (_counter)
+        _counter->bytes.fetch_sub(n * sizeof(T), std::memory_order_relaxed);
+      std::allocator<T>().deallocate(p, n);
+    }
+
+    AllocationCounter* counter() const
+    { return _counter; }
+
+  private:
+    AllocationCounter* _counter;
+};
+
+template <typename T, typename U>
+bool operator==(const CountingAllocator<T>& a, const CountingAllocator<U>& b)
+{ return a.counter() == b.counter(); }
+
+template <typename T, typename U>
+bool operator!=(const CountingAllocator<T>& a, const CountingAllocator<U>& b)
+{ return a.counter() != b.counter(); }
+
+using CountedString = std::basic_string<char, std::char_traits<char>, CountingAllocator<char>>;
+
+}
+#endif
@@ -9,8 +9,13 @@
 #ifndef DTRIE_H
 #define DTRIE_H
 
+#include <algorithm>
 #include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
@@ -22,6 +27,25 @@ namespace cedar
 
 typedef da<int> dar;
 
+// memory of a trie in bytes, *_used for the elements in use and
+// *_allocated for the allocated capacity
+struct TrieMemory
+{
+  size_t nodes = 0;
+  size_t node_capacity = 0;
+  size_t array_used = 0;
+  size_t array_allocated = 0;   // 0 if the array is mapped from a file
+  size_t ninfo_used = 0;
+  size_t ninfo_allocated = 0;
+  size_t block_used = 0;
+  size_t block_allocated = 0;
+  size_t keys = 0;              // _key strings and their vector
+  size_t mapped = 0;            // node array used in place from loaded storage
+
+  size_t allocated() const
+  { return array_allocated + ninfo_allocated + block_allocated + keys; }
+};
+
 class DTrie
 {
   public:
@@ -73,6 +97,12 @@ class DTrie
       return _key[id];
     }
 
+    const std::string& key(size_t id) const
+    {
+      assert(id < _size);
+      return _key[id];
+    }
+
     int get_index(const char* word, size_t len) const
     {
       auto result_pair = _da->exactMatchSearch<result_type>(word, len);
@@ -92,6 +122,7 @@ class DTrie
     {
       if (get_index(word, len) < 0)
       {
+        detach();
         _da->update(word, len, _size ++);
         _key.emplace_back(std::string(word, len));
       }
@@ -101,6 +132,7 @@ class DTrie
     {
       if (get_index(word) < 0)
       {
+        detach();
         _da->update(word.data(), word.size(), _size ++);
         _key.emplace_back(word);
       }
@@ -113,15 +145,26 @@ class DTrie
     }
 
     std::vector<std::pair<size_t, std::string>>
-    parse(const std::string& text, size_t max_prefix_matches = 128) const
+    parse(const std::string& text, size_t max_prefix_matches = 128,
+          const std::function<void()>& check = nullptr) const
+    { return parse(text.data(), text.size(), max_prefix_matches, check); }
+
+    std::vector<std::pair<size_t, std::string>>
+    parse(const char* data, size_t len, size_t max_prefix_matches = 128,
+          const std::function<void()>& check = nullptr) const
     {
-      auto data = text.data();
-      size_t cur = 0, len = text.size();
+      size_t cur = 0, next_check = _check_interval;
       std::vector<std::pair<size_t, std::string>> result;
       std::vector<result_type> result_pairs;
       result_pairs.reserve(max_prefix_matches);
       while (cur < len)
       {
+        // check may interrupt a long parse by throwing
+        if (check && cur >= next_check)
+        {
+          next_check = cur + _check_interval;
+          check();
+        }
         size_t n = _da->commonPrefixSearch(data + cur, result_pairs.data(),
             max_prefix_matches, len - cur);
         for (size_t i = 0; i < n && i < max_prefix_matches; i++)
@@ -139,6 +182,25 @@ class DTrie
       return result;
     }
 
+    // index of the longest key which is a prefix of text, -1 if none
+    int max_prefix(const char* text, size_t len, size_t& prefix_len) const
+    {
+      int index = -1;
+      size_t from = 0;
+      for (size_t pos = 0; pos < len; )
+      {
+        int result = _da->traverse(text, from, pos, pos + 1);
+        if (result == dar::CEDAR_NO_PATH)
+          break;
+        if (result != dar::CEDAR_NO_VALUE)
+        {
+          index = result;
+          prefix_len = pos;
+        }
+      }
+      return index;
+    }
+
     std::string
     max_prefix(const std::string& text, size_t max_prefix_matches = 128) const
     {
@@ -152,10 +214,132 @@ class DTrie
       return _key[result_pairs[n - 1].value];
     }
   
+    // append the keys and the double array to out, the array aligned to
+    // 8 bytes from the start of out
+    void save(std::string& out) const
+    {
+      write<uint64_t>(out, _size);
+      for (size_t i = 0; i < _size; i++)
+      {
+        write<uint32_t>(out, _key[i].size());
+        out.append(_key[i]);
+      }
+      write<uint64_t>(out, _da->size());
+      out.append((8 - out.size() % 8) % 8, '\0');
+      out.append(static_cast<const char*>(_da->array()), _da->size() * _da->unit_size());
+    }
+
+    TrieMemory memory_usage() const
+    {
+      TrieMemory memory;
+      size_t unit = _da->unit_size();
+      memory.nodes = _da->size();
+      memory.node_capacity = _da->owns_array() ? std::max(_da->capacity(), _da->size()) :
+        _da->size();
+      memory.array_used = memory.nodes * unit;
+      if (_mapped)
+        memory.mapped = memory.array_used;
+      else
+        memory.array_allocated = memory.node_capacity * unit;
+      memory.ninfo_used = (_da->ninfo_capacity() ? memory.nodes : 0) * _da->ninfo_unit_size();
+      memory.ninfo_allocated = _da->ninfo_capacity() * _da->ninfo_unit_size();
+      memory.block_used = (_da->block_capacity() ? memory.nodes >> 8 : 0) *
+        _da->block_unit_size();
+      memory.block_allocated = _da->block_capacity() * _da->block_unit_size();
+
+      // strings hold their characters inline up to a small size
+      memory.keys = _key.capacity() * sizeof(std::string);
+      for (size_t i = 0; i < _key.size(); i++)
+      {
+        const char* p = _key[i].data();
+        const char* inline_start = reinterpret_cast<const char*>(&_key[i]);
+        if (p < inline_start || p >= inline_start + sizeof(std::string))
+          memory.keys += _key[i].capacity() + 1;
+      }
+      return memory;
+    }
+
+    // read a trie saved at data + pos and advance pos; the double array is
+    // used in place if storage owns data, otherwise it is copied
+    void load(const char* data, size_t size, size_t& pos,
+              const std::shared_ptr<const void>& storage = nullptr)
+    {
+      size_t num_keys = read<uint64_t>(data, size, pos);
+      std::vector<std::string> key;
+      key.reserve(std::min(num_keys, size));
+      for (size_t i = 0; i < num_keys; i++)
+      {
+        size_t len = read<uint32_t>(data, size, pos);
+        if (size - pos < len)
+          throw std::invalid_argument("truncated double-array trie data!");
+        key.emplace_back(data + pos, len);
+        pos += len;
+      }
+
+      size_t num_nodes = read<uint64_t>(data, size, pos);
+      pos += (8 - pos % 8) % 8;
+      std::unique_ptr<dar> da(new dar());
+      size_t bytes = num_nodes * da->unit_size();
+      if (pos > size || size - pos < bytes)
+        throw std::invalid_argument("truncated double-array trie data!");
+      const char* nodes = data + pos;
+      std::shared_ptr<const void> owner = storage;
+      if (!owner || reinterpret_cast<uintptr_t>(nodes) % sizeof(int))
+      {
+        void* copy = std::malloc(std::max(bytes, size_t(1)));
+        if (!copy)
+          throw std::bad_alloc();
+        std::memcpy(copy, nodes, bytes);
+        owner = std::shared_ptr<const void>(copy, std::free);
+        nodes = static_cast<const char*>(copy);
+      }
+      da->set_array(const_cast<char*>(nodes), num_nodes);
+      pos += bytes;
+
+      _da = std::move(da);
+      _mapped = owner == storage;
+      _storage = owner;
+      _key.swap(key);
+      _size = num_keys;
+    }
+
   private:
+    static const size_t _check_interval = 1 << 16;
+
+    template <typename T>
+    static void write(std::string& out, T value)
+    { out.append(reinterpret_cast<const char*>(&value), sizeof(T)); }
+
+    template <typename T>
+    static T read(const char* data, size_t size, size_t& pos)
+    {
+      if (pos > size || size - pos < sizeof(T))
+        throw std::invalid_argument("truncated double-array trie data!");
+      T value;
+      std::memcpy(&value, data + pos, sizeof(T));
+      pos += sizeof(T);
+      return value;
+    }
+
+    // a loaded double array is read-only, it is rebuilt from the keys
+    // before the first update
+    void detach()
+    {
+      if (!_storage)
+        return;
+      std::unique_ptr<dar> da(new dar());
+      for (size_t i = 0; i < _size; i++)
+        da->update(_key[i].data(), _key[i].size(), int(i));
+      _da = std::move(da);
+      _storage.reset();
+      _mapped = false;
+    }
+
     size_t _size;
     std::unique_ptr<dar> _da;
     std::vector<std::string> _key;
+    std::shared_ptr<const void> _storage;  // memory of a loaded double array
+    bool _mapped = false;                  // whether _storage is the caller's
 };
 
 }
@@ -0,0 +1,211 @@
+/**
+ * Copyright (c) 2022-present, Zejun Wang (wangzejunscut@126.com)
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef ENCODE_CACHE_H
+#define ENCODE_CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "counting_allocator.h"
+#include "text_view.h"
+
+namespace tokenizer
+{
+
+struct CacheStats
+{
+  size_t hits = 0;
+  size_t misses = 0;
+  size_t evictions = 0;
+  size_t duplicates = 0;  // texts served by an identical text of the same batch
+  size_t size = 0;
+  size_t bytes = 0;       // allocated by the entries and their indexes
+
+  double hit_rate() const
+  { return hits + misses > 0 ? double(hits) / (hits + misses) : 0; }
+};
+
+// bounded LRU cache from texts and encode options to encoded rows,
+// split into independently locked shards by the hash of the text
+class EncodeCache
+{
+  public:
+    // capacity entries in total, texts longer than max_text_bytes are
+    // not cached
+    EncodeCache(size_t capacity, int num_shards = 16, size_t max_text_bytes = 4096)
+    : _max_text_bytes(max_text_bytes),
+      _hits(0), _misses(0), _evictions(0), _duplicates(0)
+    {
+      num_shards = std::max(num_shards, 1);
+      _shard_capacity = std::max(capacity / num_shards, size_t(1));
+      for (int i = 0; i < num_shards; i++)
+        _shards.emplace_back(new Shard(&_allocated));
+    }
+
+    EncodeCache(const EncodeCache&) = delete;
+    EncodeCache& operator=(const EncodeCache&) = delete;
+
+    // options of encode which the encoded row depends on
+    static int options(bool add_cls_sep, bool truncation, int max_length)
+    { return int(add_cls_sep) | (int(truncation) << 1) | ((truncation ? max_length : 0) << 2); }
+
+    bool get(const TextView& text, int options,
+        std::vector<int>& input_ids, std::vector<int>& offsets, bool& truncated)
+    {
+      if (text.size() > _max_text_bytes)
+        return false;
+      size_t hash = TextViewHash()(text);
+      Shard& shard = *_shards[hash % _shards.size()];
+      {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto range = shard.index.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+          auto entry = it->second;
+          if (entry->options != options || !same_text(*entry, text))
+            continue;
+          shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+          input_ids.assign(entry->input_ids.begin(), entry->input_ids.end());
+          offsets.assign(entry->offsets.begin(), entry->offsets.end());
+          truncated = entry->truncated;
+          _hits.fetch_add(1, std::memory_order_relaxed);
+          return true;
+        }
+      }
+      _misses.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    void put(const TextView& text, int options,
+        const std::vector<int>& input_ids, const std::vector<int>& offsets, bool truncated)
+    {
+      if (text.size() > _max_text_bytes)
+        return;
+      size_t hash = TextViewHash()(text);
+      Shard& shard = *_shards[hash % _shards.size()];
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      auto range = shard.index.equal_range(hash);
+      for (auto it = range.first; it != range.second; ++it)
+        if (it->second->options == options && same_text(*it->second, text))
+          return;
+
+      shard.lru.emplace_front(&_allocated);
+      Entry& entry = shard.lru.front();
+      entry.hash = hash;
+      entry.text.assign(text.data(), text.size());
+      entry.options = options;
+      entry.input_ids.assign(input_ids.begin(), input_ids.end());
+      entry.offsets.assign(offsets.begin(), offsets.end());
+      entry.truncated = truncated;
+      shard.index.emplace(hash, shard.lru.begin());
+      if (shard.lru.size() <= _shard_capacity)
+        return;
+
+      // evict the least recently used entry
+      auto last = std::prev(shard.lru.end());
+      range = shard.index.equal_range(last->hash);
+      for (auto it = range.first; it != range.second; ++it)
+        if (it->second == last)
+        {
+          shard.index.erase(it);
+          break;
+        }
+      shard.lru.pop_back();
+      _evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void count_duplicates(size_t n)
+    { _duplicates.fetch_add(n, std::memory_order_relaxed); }
+
+    CacheStats stats() const
+    {
+      CacheStats stats;
+      stats.hits = _hits.load(std::memory_order_relaxed);
+      stats.misses = _misses.load(std::memory_order_relaxed);
+      stats.evictions = _evictions.load(std::memory_order_relaxed);
+      stats.duplicates = _duplicates.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < _shards.size(); i++)
+      {
+        std::lock_guard<std::mutex> lock(_shards[i]->mutex);
+        stats.size += _shards[i]->lru.size();
+      }
+      stats.bytes = _allocated.get();
+      return stats;
+    }
+
+    void clear()
+    {
+      for (size_t i = 0; i < _shards.size(); i++)
+      {
+        std::lock_guard<std::mutex> lock(_shards[i]->mutex);
+        _shards[i]->index.clear();
+        _shards[i]->lru.clear();
+      }
+      _hits = 0;
+      _misses = 0;
+      _evictions = 0;
+      _duplicates = 0;
+    }
+
+  private:
+    // entries and indexes allocate through _allocated
+    struct Entry
+    {
+      size_t hash;
+      CountedString text;
+      int options;
+      std::vector<int, CountingAllocator<int>> input_ids;
+      std::vector<int, CountingAllocator<int>> offsets;
+      bool truncated;
+
+      Entry(AllocationCounter* counter)
+      : hash(0), text(CountingAllocator<char>(counter)), options(0),
+        input_ids(CountingAllocator<int>(counter)), offsets(CountingAllocator<int>(counter)),
+        truncated(false) {}
+    };
+
+    using List = std::list<Entry, CountingAllocator<Entry>>;
+    using Index = std::unordered_multimap<size_t, List::iterator, std::hash<size_t>,
+      std::equal_to<size_t>, CountingAllocator<std::pair<const size_t, List::iterator>>>;
+
+    struct Shard
+    {
+      mutable std::mutex mutex;
+      List lru;  // most recently used first
+      Index index;
+
+      Shard(AllocationCounter* counter)
+      : lru(CountingAllocator<Entry>(counter)),
+        index(0, std::hash<size_t>(), std::equal_to<size_t>(),
+          CountingAllocator<std::pair<const size_t, List::iterator>>(counter)) {}
+    };
+
+    static bool same_text(const Entry& entry, const TextView& text)
+    { return TextView(entry.text.data(), entry.text.size()) == text; }
+
+    AllocationCounter _allocated;  // declared first, outlives the shards
+
+    std::vector<std::unique_ptr<Shard>> _shards;
+    size_t _shard_capacity;
+    size_t _max_text_bytes;
+    std::atomic<size_t> _hits;
+    std::atomic<size_t> _misses;
+    std::atomic<size_t> _evictions;
+    std::atomic<size_t> _duplicates;
+};
+
+}
+#endif
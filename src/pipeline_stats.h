@@ -0,0 +1,354 @@
+/**
+ * Copyright (c) 2022-present, Zejun Wang (wangzejunscut@126.com)
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace tokenizer
+{
+
+// pipeline counters, recorded when compiled with WITH_STATS
+enum StatsCounter
+{
+  STATS_TEXTS = 0,
+  STATS_BYTES,
+  STATS_BASE_TOKENS,
+  STATS_WORDPIECES,
+  STATS_UNKNOWN_TOKENS,   // [UNK] ids in the output
+  STATS_TRUNCATIONS,
+  STATS_LONG_WORDS,       // words longer than _max_input_chars_per_word
+  STATS_SPECIAL_TOKENS,   // matches of special tokens in the texts
+  STATS_CACHE_HITS,
+  STATS_CACHE_MISSES,
+  NUM_STATS_COUNTERS
+};
+
+// timed stages, encode covers a row from the cache lookup to truncation
+// and batch a whole batch encode call
+enum StatsStage
+{
+  STAGE_BASIC_TOKENIZE = 0,
+  STAGE_WORDPIECE,
+  STAGE_ENCODE,
+  STAGE_BATCH,
+  NUM_STATS_STAGES
+};
+
+// latencies in power of two buckets of nanoseconds, bucket b holds
+// latencies in [2^(b - 1), 2^b)
+struct LatencyHistogram
+{
+  static const int num_buckets = 40;
+  size_t buckets[num_buckets] = {};
+  size_t count = 0;
+  double total_ns = 0;
+
+  static int bucket(uint64_t ns)
+  {
+    int b = 0;
+    while (ns && b < num_buckets - 1)
+    {
+      ns >>= 1;
+      b++;
+    }
+    return b;
+  }
+
+  double mean_ns() const
+  { return count > 0 ? total_ns / count : 0; }
+
+  // upper bound of the bucket holding the p-th quantile
+  double percentile(double p) const
+  {
+    if (count == 0)
+      return 0;
+    size_t rank = std::min(count - 1, size_t(p * count)), seen = 0;
+    for (int b = 0; b < num_buckets; b++)
+    {
+      seen += buckets[b];
+      if (seen > rank)
+        return double(uint64_t(1) << b);
+    }
+    return double(uint64_t(1) << (num_buckets - 1));
+  }
+};
+
+struct PipelineStats
+{
+  bool enabled = false;   // whether the library was compiled with WITH_STATS
+  size_t counters[NUM_STATS_COUNTERS] = {};
+  LatencyHistogram stages[NUM_STATS_STAGES];
+
+  size_t texts() const { return counters[STATS_TEXTS]; }
+  size_t bytes() const { return counters[STATS_BYTES]; }
+  size_t base_tokens() const { return counters[STATS_BASE_TOKENS]; }
+  size_t wordpieces() const { return counters[STATS_WORDPIECES]; }
+  size_t unknown_tokens() const { return counters[STATS_UNKNOWN_TOKENS]; }
+  size_t truncations() const { return counters[STATS_TRUNCATIONS]; }
+  size_t long_words() const { return counters[STATS_LONG_WORDS]; }
+  size_t special_tokens() const { return counters[STATS_SPECIAL_TOKENS]; }
+  size_t cache_hits() const { return counters[STATS_CACHE_HITS]; }
+  size_t cache_misses() const { return counters[STATS_CACHE_MISSES]; }
+
+  // share of the wordpiece ids that are [UNK]
+  double unk_rate() const
+  { return wordpieces() > 0 ? double(unknown_tokens()) / wordpieces() : 0; }
+
+  static const char* counter_name(int counter)
+  {
+    static const char* names[NUM_STATS_COUNTERS] = {"texts", "bytes", "base_tokens",
+      "wordpieces", "unknown_tokens", "truncations", "long_words", "special_tokens",
+      "cache_hits", "cache_misses"};
+    return names[counter];
+  }
+
+  static const char* stage_name(int stage)
+  {
+    static const char* names[NUM_STATS_STAGES] = {"basic_tokenize", "wordpiece",
+      "encode", "batch"};
+    return names[stage];
+  }
+};
+
+// counters of a tokenizer kept per thread, so that recording only touches
+// memory of the calling thread, and summed when read
+class StatsRegistry
+{
+  public:
+    StatsRegistry() : _id(next_id()), _state(std::make_shared<State>()) {}
+
+    StatsRegistry(const StatsRegistry&) = delete;
+    StatsRegistry& operator=(const StatsRegistry&) = delete;
+
+    // nothing is recorded on the calling thread while a Pause is alive
+    class Pause
+    {
+      public:
+        Pause() : _paused(paused()) { paused() = true; }
+        ~Pause() { paused() = _paused; }
+
+      private:
+        bool _paused;
+    };
+
+    void add(int counter, size_t n)
+    {
+      if (paused())
+        return;
+      auto& value = local().counters[counter];
+      value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void record(int stage, uint64_t ns)
+    {
+      if (paused())
+        return;
+      Shard& shard = local();
+      auto& bucket = shard.buckets[stage][LatencyHistogram::bucket(ns)];
+      bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      auto& total = shard.total_ns[stage];
+      total.store(total.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    }
+
+    PipelineStats snapshot() const
+    {
+      PipelineStats stats = sum();
+      PipelineStats baseline;
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        baseline = _baseline;
+      }
+      for (int c = 0; c < NUM_STATS_COUNTERS; c++)
+        stats.counters[c] -= baseline.counters[c];
+      for (int s = 0; s < NUM_STATS_STAGES; s++)
+      {
+        LatencyHistogram& h = stats.stages[s];
+        const LatencyHistogram& base = baseline.stages[s];
+        for (int b = 0; b < LatencyHistogram::num_buckets; b++)
+          h.buckets[b] -= base.buckets[b];
+        h.count -= base.count;
+        h.total_ns -= base.total_ns;
+      }
+      return stats;
+    }
+
+    // counters only ever grow on their threads, a reset moves the baseline
+    void reset()
+    {
+      PipelineStats stats = sum();
+      std::lock_guard<std::mutex> lock(_mutex);
+      _baseline = stats;
+    }
+
+  private:
+    struct Shard
+    {
+      std::atomic<size_t> counters[NUM_STATS_COUNTERS];
+      std::atomic<size_t> buckets[NUM_STATS_STAGES][LatencyHistogram::num_buckets];
+      std::atomic<uint64_t> total_ns[NUM_STATS_STAGES];
+
+      Shard()
+      {
+        for (int c = 0; c < NUM_STATS_COUNTERS; c++)
+          counters[c] = 0;
+        for (int s = 0; s < NUM_STATS_STAGES; s++)
+        {
+          for (int b = 0; b < LatencyHistogram::num_buckets; b++)
+            buckets[s][b] = 0;
+          total_ns[s] = 0;
+        }
+      }
+    };
+
+    // shards of a registry, shared with the threads recording into it
+    // so that either can go away first
+    struct State
+    {
+      std::mutex mutex;
+      std::vector<std::unique_ptr<Shard>> shards;
+      PipelineStats retired;   // counters of the shards of exited threads
+    };
+
+    // shards of the calling thread, folded into the retired counters of
+    // their registries when the thread exits
+    struct LocalShards
+    {
+      std::unordered_map<size_t, std::pair<std::weak_ptr<State>, Shard*>> shards;
+
+      ~LocalShards()
+      {
+        for (auto& entry : shards)
+          if (auto state = entry.second.first.lock())
+            retire(*state, entry.second.second);
+      }
+    };
+
+    // registries get ids that are never reused, so the shards a thread
+    // remembers for a destroyed registry are never looked up again
+    static size_t next_id()
+    {
+      static std::atomic<size_t> id(0);
+      return ++id;
+    }
+
+    static void accumulate(const Shard& shard, PipelineStats& stats)
+    {
+      for (int c = 0; c < NUM_STATS_COUNTERS; c++)
+        stats.counters[c] += shard.counters[c].load(std::memory_order_relaxed);
+      for (int s = 0; s < NUM_STATS_STAGES; s++)
+      {
+        LatencyHistogram& h = stats.stages[s];
+        for (int b = 0; b < LatencyHistogram::num_buckets; b++)
+        {
+          size_t n = shard.buckets[s][b].load(std::memory_order_relaxed);
+          h.buckets[b] += n;
+          h.count += n;
+        }
+        h.total_ns += shard.total_ns[s].load(std::memory_order_relaxed);
+      }
+    }
+
+    static void retire(State& state, Shard* shard)
+    {
+      std::lock_guard<std::mutex> lock(state.mutex);
+      accumulate(*shard, state.retired);
+      for (size_t i = 0; i < state.shards.size(); i++)
+      {
+        if (state.shards[i].get() == shard)
+        {
+          state.shards.erase(state.shards.begin() + i);
+          break;
+        }
+      }
+    }
+
+    static bool& paused()
+    {
+      thread_local bool value = false;
+      return value;
+    }
+
+    Shard& local()
+    {
+      thread_local size_t last_id = 0;
+      thread_local Shard* last = nullptr;
+      if (last_id == _id)
+        return *last;
+      thread_local LocalShards local_shards;
+      auto& shards = local_shards.shards;
+      auto it = shards.find(_id);
+      if (it == shards.end())
+      {
+        // forget the shards of destroyed registries
+        for (auto entry = shards.begin(); entry != shards.end();)
+        {
+          if (entry->second.first.expired())
+            entry = shards.erase(entry);
+          else
+            ++entry;
+        }
+        Shard* shard = new Shard();
+        {
+          std::lock_guard<std::mutex> lock(_state->mutex);
+          _state->shards.emplace_back(shard);
+        }
+        it = shards.emplace(_id, std::make_pair(std::weak_ptr<State>(_state), shard)).first;
+      }
+      last_id = _id;
+      last = it->second.second;
+      return *last;
+    }
+
+    PipelineStats sum() const
+    {
+      std::lock_guard<std::mutex> lock(_state->mutex);
+      PipelineStats stats = _state->retired;
+      stats.enabled = true;
+      for (auto& shard : _state->shards)
+        accumulate(*shard, stats);
+      return stats;
+    }
+
+    size_t _id;
+    std::shared_ptr<State> _state;
+    mutable std::mutex _mutex;   // guards _baseline
+    PipelineStats _baseline;
+};
+
+// records the time from construction to destruction as one latency of stage
+class StageTimer
+{
+  public:
+    StageTimer(StatsRegistry* stats, int stage)
+    : _stats(stats), _stage(stage), _start(std::chrono::steady_clock::now()) {}
+
+    ~StageTimer()
+    {
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - _start).count();
+      _stats->record(_stage, ns);
+    }
+
+  private:
+    StatsRegistry* _stats;
+    int _stage;
+    std::chrono::steady_clock::time_point _start;
+};
+
+}
+#endif
@@ -0,0 +1,306 @@
+/**
+ * Copyright (c) 2022-present, Zejun Wang (wangzejunscut@126.com)
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef STREAM_ENCODER_H
+#define STREAM_ENCODER_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "tokenizer.h"
+
+namespace tokenizer
+{
+
+// encoded lines of a file
+struct StreamBatch
+{
+  size_t index = 0;       // sequence number of the batch
+  size_t first_line = 0;  // line number of texts[0] in the file
+  std::vector<std::string> texts;
+  std::vector<std::vector<int>> input_ids;
+  std::vector<std::vector<int>> attention_mask;
+  std::vector<std::vector<int>> offsets;
+};
+
+// pipeline encoding the lines of a file: a reader thread splits large
+// buffered reads into batches of batch_size lines, num_workers threads
+// encode them and the batches are handed out in file order; at most
+// max_in_flight batches (default 4 per worker) are read ahead, so memory
+// is bounded regardless of the file size
+class StreamEncoder
+{
+  public:
+    using BatchPtr = std::unique_ptr<StreamBatch>;
+
+    StreamEncoder(const Tokenizer& tokenizer,
+                  const std::string& path,
+                  int num_workers = 1,
+                  int batch_size = 64,
+                  int max_in_flight = 0,
+                  bool add_cls_sep = true,
+                  bool padding = true,
+                  bool truncation = true,
+                  int max_length = 512)
+    : _tokenizer(tokenizer),
+      _batch_size(std::max(batch_size, 1)),
+      _max_in_flight(max_in_flight > 0 ? max_in_flight : 4 * std::max(num_workers, 1)),
+      _add_cls_sep(add_cls_sep), _padding(padding), _truncation(truncation),
+      _max_length(max_length),
+      _input(_max_in_flight), _output(_max_in_flight), _pending(_max_in_flight),
+      _next_index(0), _bytes_read(0), _num_batches(0),
+      _read_done(false), _consumed(0), _stop(false)
+    {
+      _file = std::fopen(path.c_str(), "rb");
+      if (!_file)
+        throw std::invalid_argument(path + " can not be opened for loading!");
+      _reader = std::thread(&StreamEncoder::read, this);
+      for (int i = 0; i < std::max(num_workers, 1); i++)
+        _workers.emplace_back(&StreamEncoder::work, this);
+    }
+
+    ~StreamEncoder()
+    {
+      _stop = true;
+      _reader.join();
+      for (auto& t : _workers)
+        t.join();
+      std::fclose(_file);
+    }
+
+    StreamEncoder(const StreamEncoder&) = delete;
+    StreamEncoder& operator=(const StreamEncoder&) = delete;
+
+    // next batch in file order, false at the end of the file; errors of
+    // the reader or the workers are rethrown here
+    bool next(StreamBatch& batch)
+    {
+      size_t slot = _next_index % _max_in_flight;
+      Backoff backoff;
+      while (!_pending[slot])
+      {
+        check_error();
+        if (_read_done.load(std::memory_order_acquire) && _next_index == _num_batches)
+          return false;
+
+        // park out-of-order batches until their turn comes
+        BatchPtr ptr;
+        if (_output.try_pop(ptr))
+        {
+          size_t index = ptr->index;
+          _pending[index % _max_in_flight] = std::move(ptr);
+          backoff.reset();
+        }
+        else
+          backoff.wait();
+      }
+      batch = std::move(*_pending[slot]);
+      _pending[slot].reset();
+      _next_index++;
+      _consumed.store(_next_index, std::memory_order_release);
+      return true;
+    }
+
+    // hand every batch to writer in file order on the calling thread,
+    // return the number of lines
+    size_t run(const std::function<void(const StreamBatch&)>& writer)
+    {
+      size_t num_lines = 0;
+      StreamBatch batch;
+      while (next(batch))
+      {
+        writer(batch);
+        num_lines += batch.texts.size();
+      }
+      return num_lines;
+    }
+
+    size_t bytes_read() const
+    { return _bytes_read.load(std::memory_order_relaxed); }
+
+  private:
+    static const size_t _read_size = 1 << 20;
+
+    void fail()
+    {
+      std::lock_guard<std::mutex> lock(_error_mutex);
+      if (!_error)
+        _error = std::current_exception();
+      _stop = true;
+    }
+
+    void check_error()
+    {
+      std::lock_guard<std::mutex> lock(_error_mutex);
+      if (_error)
+        std::rethrow_exception(_error);
+    }
+
+    // move batch into queue, false if the pipeline is stopped
+    bool push(BoundedQueue<BatchPtr>& queue, BatchPtr& batch)
+    {
+      Backoff backoff;
+      while (!queue.try_push(batch))
+      {
+        if (_stop)
+          return false;
+        backoff.wait();
+      }
+      return true;
+    }
+
+    // send the current batch once the read-ahead limit allows it
+    bool send(BatchPtr& batch, size_t& num_lines)
+    {
+      Backoff backoff;
+      while (batch->index - _consumed.load(std::memory_order_acquire) >= _max_in_flight)
+      {
+        if (_stop)
+          return false;
+        backoff.wait();
+      }
+      size_t index = batch->index;
+      num_lines += batch->texts.size();
+      if (!push(_input, batch))
+        return false;
+      batch = BatchPtr(new StreamBatch());
+      batch->index = index + 1;
+      batch->first_line = num_lines;
+      batch->texts.reserve(_batch_size);
+      return true;
+    }
+
+    void read()
+    {
+      try
+      {
+        std::vector<char> buffer(_read_size);
+        std::string line;
+        size_t num_lines = 0;
+        BatchPtr batch(new StreamBatch());
+        batch->texts.reserve(_batch_size);
+        bool open = false;  // whether line holds an unfinished line
+        while (!_stop)
+        {
+          size_t n = std::fread(buffer.data(), 1, buffer.size(), _file);
+          if (n == 0)
+          {
+            if (std::ferror(_file))
+              throw std::runtime_error("failed reading the input file!");
+            break;
+          }
+          _bytes_read.fetch_add(n, std::memory_order_relaxed);
+
+          const char* data = buffer.data();
+          const char* end = data + n;
+          while (data < end)
+          {
+            const char* newline = static_cast<const char*>(std::memchr(data, '\n', end - data));
+            if (!newline)
+            {
+              line.append(data, end);
+              open = true;
+              break;
+            }
+            line.append(data, newline);
+            data = newline + 1;
+            open = false;
+            batch->texts.emplace_back(std::move(line));
+            line.clear();
+            if (int(batch->texts.size()) == _batch_size && !send(batch, num_lines))
+              return;
+          }
+        }
+
+        // the last line may lack its newline
+        if (open && line.size())
+          batch->texts.emplace_back(std::move(line));
+        size_t num_batches = batch->index;
+        if (batch->texts.size())
+        {
+          num_batches++;
+          if (!send(batch, num_lines))
+            return;
+        }
+        _num_batches = num_batches;
+        _read_done.store(true, std::memory_order_release);
+      }
+      catch (...)
+      {
+        fail();
+      }
+    }
+
+    void work()
+    {
+      try
+      {
+        Backoff backoff;
+        BatchPtr batch;
+        while (!_stop)
+        {
+          if (!_input.try_pop(batch))
+          {
+            if (_read_done.load(std::memory_order_acquire) && !_input.try_pop(batch))
+              return;
+            if (!batch)
+            {
+              backoff.wait();
+              continue;
+            }
+          }
+          backoff.reset();
+          _tokenizer.encode(batch->texts, batch->input_ids, batch->attention_mask,
+            batch->offsets, 1, _add_cls_sep, _padding, false, _truncation, _max_length);
+          if (!push(_output, batch))
+            return;
+          batch.reset();
+        }
+      }
+      catch (...)
+      {
+        fail();
+      }
+    }
+
+    const Tokenizer& _tokenizer;
+    int _batch_size;
+    size_t _max_in_flight;
+    bool _add_cls_sep, _padding, _truncation;
+    int _max_length;
+
+    std::FILE* _file;
+    BoundedQueue<BatchPtr> _input;
+    BoundedQueue<BatchPtr> _output;
+    std::vector<BatchPtr> _pending;  // reorder buffer indexed by index % _max_in_flight
+    size_t _next_index;
+
+    std::atomic<size_t> _bytes_read;
+    size_t _num_batches;             // published by _read_done
+    std::atomic<bool> _read_done;
+    std::atomic<size_t> _consumed;
+    std::atomic<bool> _stop;
+    std::mutex _error_mutex;
+    std::exception_ptr _error;
+
+    std::thread _reader;
+    std::vector<std::thread> _workers;
+};
+
+}
+#endif
@@ -0,0 +1,87 @@
+/**
+ * Copyright (c) 2022-present, Zejun Wang (wangzejunscut@126.com)
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef TEXT_VIEW_H
+#define TEXT_VIEW_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace tokenizer
+{
+
+// bytes of a text owned by a std::string or a buffer of the caller, which
+// must outlive the view
+class TextView
+{
+  public:
+    TextView() : _data(nullptr), _size(0) {}
+    TextView(const char* data, size_t size) : _data(data), _size(size) {}
+    TextView(const char* text) : _data(text), _size(std::strlen(text)) {}
+    TextView(const std::string& text) : _data(text.data()), _size(text.size()) {}
+
+    const char* data() const
+    { return _data; }
+
+    size_t size() const
+    { return _size; }
+
+    bool empty() const
+    { return _size == 0; }
+
+    char operator[](size_t i) const
+    { return _data[i]; }
+
+    TextView substr(size_t pos, size_t n = std::string::npos) const
+    { return TextView(_data + pos, std::min(n, _size - pos)); }
+
+    std::string str() const
+    { return std::string(_data, _size); }
+
+    bool operator==(const TextView& other) const
+    { return _size == other._size && std::memcmp(_data, other._data, _size) == 0; }
+
+  private:
+    const char* _data;
+    size_t _size;
+};
+
+// hash of the bytes, 8 at a time
+struct TextViewHash
+{
+  static uint64_t mix(uint64_t h)
+  {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  size_t operator()(const TextView& text) const
+  {
+    const char* data = text.data();
+    size_t size = text.size(), i = 0;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ size, word = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+      std::memcpy(&word, data + i, 8);
+      h = (h ^ mix(word)) * 0x100000001b3ULL;
+    }
+    word = 0;
+    if (i < size)
+      std::memcpy(&word, data + i, size - i);
+    return size_t(mix(h ^ mix(word)));
+  }
+};
+
+}
+#endif
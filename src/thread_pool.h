@@ -0,0 +1,431 @@
+/**
+ * Copyright (c) 2022-present, Zejun Wang (wangzejunscut@126.com)
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace tokenizer
+{
+
+// thrown by work that observed a cancelled token
+class CancelledError : public std::runtime_error
+{
+  public:
+    CancelledError() : std::runtime_error("operation cancelled") {}
+};
+
+// shared flag to cancel queued or running work, copies share the flag;
+// a token with a deadline cancels itself once the deadline passes
+class CancelToken
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    CancelToken() : _state(std::make_shared<State>()) {}
+
+    explicit CancelToken(Clock::time_point deadline) : CancelToken()
+    { _state->deadline = deadline; }
+
+    static CancelToken after(Clock::duration timeout)
+    { return CancelToken(Clock::now() + timeout); }
+
+    void cancel()
+    { _state->cancelled = true; }
+
+    bool cancelled() const
+    {
+      if (_state->cancelled.load(std::memory_order_relaxed))
+        return true;
+      if (_state->deadline == Clock::time_point::max() || Clock::now() < _state->deadline)
+        return false;
+      _state->cancelled = true;
+      return true;
+    }
+
+  private:
+    struct State
+    {
+      std::atomic<bool> cancelled{false};
+      Clock::time_point deadline = Clock::time_point::max();
+    };
+
+    std::shared_ptr<State> _state;
+};
+
+// scheduling class of pool work, queued interactive tasks run before
+// bulk ones and bulk batches give way to them between texts
+enum Priority
+{
+  PRIORITY_INTERACTIVE = 0,
+  PRIORITY_BULK = 1
+};
+
+class ThreadPool
+{
+  public:
+    using Task = std::function<void()>;
+
+    // priority of the work started by the calling thread
+    static Priority& priority()
+    {
+      static thread_local Priority current = PRIORITY_INTERACTIVE;
+      return current;
+    }
+
+    // max_workers = 0 grows the pool on demand, queue_capacity = 0
+    // leaves the queue of submitted tasks unbounded
+    ThreadPool(int max_workers = 0, bool pin_threads = false,
+               size_t queue_capacity = 0)
+    : _max_workers(max_workers), _pin_threads(pin_threads),
+      _queue_capacity(queue_capacity), _generation(fork_generation().load())
+    {
+#ifndef _WIN32
+      static std::once_flag flag;
+      std::call_once(flag, []()
+      { pthread_atfork(nullptr, nullptr, []() { fork_generation()++; }); });
+#endif
+      _state = new State();
+    }
+
+    ~ThreadPool()
+    {
+      // a forked child abandons the workers of the parent, which it could
+      // not join, before stopping its own
+      {
+        std::lock_guard<std::mutex> lock(_workers_mutex);
+        check_fork();
+      }
+      {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        _state->stop = true;
+      }
+      _state->cv.notify_all();
+      for (auto& t : _workers)
+        t.join();
+      delete _state;
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // number of forks of the process, a child loses the work queued 
+    // before its fork
+    static int generation()
+    { return fork_generation().load(); }
+
+    int size()
+    {
+      std::lock_guard<std::mutex> lock(_workers_mutex);
+      return _workers.size();
+    }
+
+    // start workers until there are num_workers of them
+    void reserve(int num_workers)
+    {
+      std::lock_guard<std::mutex> lock(_workers_mutex);
+      check_fork();
+      if (_max_workers > 0 && num_workers > _max_workers)
+        num_workers = _max_workers;
+      while (int(_workers.size()) < num_workers)
+      {
+        _workers.emplace_back(&ThreadPool::worker, _state);
+        if (_pin_threads)
+          pin(_workers.back(), _workers.size());
+      }
+    }
+
+    // queue a task at the priority of the caller, blocks while the 
+    // bounded queue is full; tasks submitted by pool workers bypass the
+    // bound, since only workers free its slots
+    void submit(Task task)
+    { push(std::move(task), true, true, priority()); }
+
+    // queue a task unless the bounded queue is full
+    bool try_submit(Task task)
+    { return push(std::move(task), true, false, priority()); }
+
+    // run the queued interactive tasks on the calling thread, bulk work
+    // calls it between texts
+    void yield()
+    {
+      if (_state->num_interactive.load(std::memory_order_relaxed) == 0)
+        return;
+      {
+        std::lock_guard<std::mutex> lock(_workers_mutex);
+        check_fork();
+      }
+      Entry entry;
+      while (pop(_state, PRIORITY_INTERACTIVE, entry))
+        run(entry);
+    }
+
+    // run func(i) for i in [0, n) on the calling thread and up to
+    // num_threads - 1 workers, each claiming grain indices at a time
+    void parallel_for(int n, int num_threads, int grain,
+        const std::function<void(int)>& func)
+    {
+      if (n <= 0)
+        return;
+      if (grain < 1)
+        grain = 1;
+      int num_helpers = std::min(num_threads, (n + grain - 1) / grain) - 1;
+      if (num_helpers > 0)
+        reserve(num_helpers);
+
+      // helpers bypass the queue bound, they hold no work of their own
+      auto job = std::make_shared<Job>(n, grain, func);
+      for (int i = 0; i < num_helpers; i++)
+        push([job]()
+        {
+          {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            if (job->done)
+              return;
+            job->active++;
+          }
+          job->run();
+          {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->active--;
+          }
+          job->cv.notify_all();
+        }, false, true, priority());
+
+      // the caller works too, then waits for the helpers already started
+      job->run();
+      std::unique_lock<std::mutex> lock(job->mutex);
+      job->done = true;
+      job->cv.wait(lock, [&job]() { return job->active == 0; });
+      if (job->error)
+        std::rethrow_exception(job->error);
+    }
+
+  private:
+    struct Entry
+    {
+      Task task;
+      bool bounded = false;  // counted by the queue bound
+      Priority priority = PRIORITY_INTERACTIVE;
+    };
+
+    struct State
+    {
+      std::mutex mutex;
+      std::condition_variable cv;
+      std::condition_variable not_full;
+      std::deque<Entry> tasks[2];  // by priority
+      size_t num_bounded = 0;
+      std::atomic<int> num_interactive{0};
+      bool stop = false;
+    };
+
+    bool push(Task task, bool bounded, bool wait, Priority priority)
+    {
+      {
+        std::lock_guard<std::mutex> lock(_workers_mutex);
+        check_fork();
+      }
+      {
+        std::unique_lock<std::mutex> lock(_state->mutex);
+        Entry entry;
+        entry.task = std::move(task);
+        if (bounded && _queue_capacity > 0 && !(wait && on_worker()))
+        {
+          State* state = _state;
+          size_t capacity = _queue_capacity;
+          if (!wait && state->num_bounded >= capacity)
+            return false;
+          state->not_full.wait(lock, [state, capacity]()
+          { return state->num_bounded < capacity; });
+          state->num_bounded++;
+          entry.bounded = true;
+        }
+        _state->tasks[priority].emplace_back(std::move(entry));
+        if (priority == PRIORITY_INTERACTIVE)
+          _state->num_interactive++;
+      }
+      _state->cv.notify_one();
+      return true;
+    }
+
+    // take the oldest task of the highest priority up to max_priority
+    static bool pop(State* state, Priority max_priority, Entry& entry)
+    {
+      {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        int priority = 0;
+        while (priority <= max_priority && state->tasks[priority].empty())
+          priority++;
+        if (priority > max_priority)
+          return false;
+        entry = std::move(state->tasks[priority].front());
+        state->tasks[priority].pop_front();
+        if (priority == PRIORITY_INTERACTIVE)
+          state->num_interactive--;
+        if (entry.bounded)
+          state->num_bounded--;
+        entry.priority = Priority(priority);
+      }
+      if (entry.bounded)
+        state->not_full.notify_one();
+      return true;
+    }
+
+    struct Job
+    {
+      Job(int n_, int grain_, const std::function<void(int)>& func_)
+      : n(n_), grain(grain_), next(0), func(func_), active(0), done(false) {}
+
+      void run()
+      {
+        int start = 0;
+        while ((start = next.fetch_add(grain)) < n)
+        {
+          int end = std::min(start + grain, n);
+          try
+          {
+            for (int i = start; i < end; i++)
+              func(i);
+          }
+          catch (...)
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+              error = std::current_exception();
+            next = n;
+          }
+        }
+      }
+
+      int n, grain;
+      std::atomic<int> next;
+      const std::function<void(int)>& func;
+      std::mutex mutex;
+      std::condition_variable cv;
+      int active;
+      bool done;
+      std::exception_ptr error;
+    };
+
+    static std::atomic<int>& fork_generation()
+    {
+      static std::atomic<int> generation(0);
+      return generation;
+    }
+
+    // whether the calling thread is a worker of a pool
+    static bool& on_worker()
+    {
+      static thread_local bool value = false;
+      return value;
+    }
+
+    static void worker(State* state)
+    {
+      on_worker() = true;
+      Entry entry;
+      while (true)
+      {
+        {
+          std::unique_lock<std::mutex> lock(state->mutex);
+          state->cv.wait(lock, [state]()
+          { return state->stop || !state->tasks[0].empty() || !state->tasks[1].empty(); });
+          if (state->stop && state->tasks[0].empty() && state->tasks[1].empty())
+            return;
+        }
+        // a yielding thread may have taken the task meanwhile
+        if (pop(state, PRIORITY_BULK, entry))
+          run(entry);
+      }
+    }
+
+    // run a task at the priority it was queued with
+    static void run(Entry& entry)
+    {
+      Priority previous = priority();
+      priority() = entry.priority;
+      entry.task();
+      entry.task = nullptr;
+      priority() = previous;
+    }
+
+    static void pin(std::thread& t, size_t index)
+    {
+#ifdef __linux__
+      unsigned num_cpus = std::thread::hardware_concurrency();
+      if (num_cpus == 0)
+        return;
+      cpu_set_t cpuset;
+      CPU_ZERO(&cpuset);
+      CPU_SET(index % num_cpus, &cpuset);
+      pthread_setaffinity_np(t.native_handle(), sizeof(cpu_set_t), &cpuset);
+#endif
+    }
+
+    // the workers do not survive fork, the child abandons their state
+    // (its mutex may be held by a vanished thread) and starts afresh;
+    // without fork (_WIN32) the generation never changes
+    void check_fork()
+    {
+      int generation = fork_generation().load();
+      if (generation == _generation)
+        return;
+      new std::vector<std::thread>(std::move(_workers));
+      _workers.clear();
+      _state = new State();
+      _generation = generation;
+    }
+
+    int _max_workers;
+    bool _pin_threads;
+    size_t _queue_capacity;
+    int _generation;
+    State* _state;
+    std::mutex _workers_mutex;
+    std::vector<std::thread> _workers;
+};
+
+// work started by the current thread within the scope runs at priority
+class PriorityScope
+{
+  public:
+    explicit PriorityScope(Priority priority) : _previous(ThreadPool::priority())
+    { ThreadPool::priority() = priority; }
+
+    ~PriorityScope()
+    { ThreadPool::priority() = _previous; }
+
+    PriorityScope(const PriorityScope&) = delete;
+    PriorityScope& operator=(const PriorityScope&) = delete;
+
+  private:
+    Priority _previous;
+};
+
+}
+#endif
@@ -9,9 +9,133 @@
 #include "tokenizer.h"
 #include "utf8proc.h"
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// pipeline counters and stage latencies, compiled out unless WITH_STATS
+#ifdef WITH_STATS
+#define STATS_ADD(counter, n) _stats->add(counter, n)
+#define STATS_TIMER(stage) StageTimer stage_timer(_stats.get(), stage)
+#else
+#define STATS_ADD(counter, n)
+#define STATS_TIMER(stage)
+#endif
+
 namespace tokenizer
 {
 
+namespace
+{
+
+struct Workspace;
+
+// workspaces of the live threads, never destroyed so that threads exiting
+// during static destruction can still unregister
+struct WorkspaceRegistry
+{
+  std::mutex mutex;
+  std::vector<const Workspace*> workspaces;
+};
+
+WorkspaceRegistry& workspace_registry()
+{
+  static WorkspaceRegistry* registry = new WorkspaceRegistry();
+  return *registry;
+}
+
+// per-thread scratch buffers reused across calls
+struct Workspace
+{
+  std::vector<char> word;
+  std::vector<Token> base_tokens;
+  std::vector<int> byte2index;
+  std::vector<int> pos_map;
+  std::vector<std::tuple<int, int, int>> sub_tokens;
+  std::string subtoken;
+  std::vector<int> input_ids;
+  std::vector<int> offsets;
+  const CancelToken* cancel = nullptr;
+  size_t special_matches = 0;  // of the last basic_tokenize, for the stats
+  std::atomic<size_t> bytes;   // buffer capacity as of the last trim
+
+  Workspace() : bytes(0)
+  {
+    auto& registry = workspace_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.workspaces.emplace_back(this);
+  }
+
+  ~Workspace()
+  {
+    auto& registry = workspace_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto& workspaces = registry.workspaces;
+    workspaces.erase(std::find(workspaces.begin(), workspaces.end(), this));
+  }
+
+  // release the buffers grown by an unusually long text
+  void trim()
+  {
+    const size_t limit = 1 << 16;
+    if (word.capacity() > limit)
+      std::vector<char>().swap(word);
+    if (base_tokens.capacity() > limit)
+      std::vector<Token>().swap(base_tokens);
+    if (byte2index.capacity() > limit)
+      std::vector<int>().swap(byte2index);
+    // token strings of base_tokens are not counted
+    size_t n = word.capacity() + base_tokens.capacity() * sizeof(Token) +
+      sub_tokens.capacity() * sizeof(sub_tokens[0]) + subtoken.capacity() +
+      (byte2index.capacity() + pos_map.capacity() + input_ids.capacity() + 
+       offsets.capacity()) * sizeof(int);
+    bytes.store(n, std::memory_order_relaxed);
+  }
+};
+
+thread_local Workspace workspace;
+
+// bytes of a text and base tokens tokenized between cancellation checks
+const int cancel_bytes = 1 << 16;
+const int cancel_tokens = 64;
+
+// throw if the row encoded on this thread is cancelled
+void check_cancel()
+{
+  if (workspace.cancel && workspace.cancel->cancelled())
+    throw CancelledError();
+}
+
+// cancellation checked by the rows encoded in this scope
+struct CancelScope
+{
+  CancelScope(const CancelToken* cancel) : previous(workspace.cancel)
+  { workspace.cancel = cancel; }
+
+  ~CancelScope()
+  { workspace.cancel = previous; }
+
+  const CancelToken* previous;
+};
+
+// whether an occurrence of b may start inside an occurrence of a, or at 
+// its start for another token
+bool may_overlap(const std::string& a, const std::string& b)
+{
+  for (size_t k = (a == b) ? 1 : 0; k < a.size(); k++)
+  {
+    size_t m = std::min(a.size() - k, b.size());
+    if (a.compare(k, m, b, 0, m) == 0)
+      return true;
+  }
+  return false;
+}
+
+}
+
 BasicTokenizer::BasicTokenizer(bool do_lower_case) : _do_lower_case(do_lower_case)
 {
   _special = std::unique_ptr<Trie>(new Trie());
@@ -22,14 +146,19 @@ BasicTokenizer::BasicTokenizer(bool do_lower_case) : _do_lower_case(do_lower_cas
   _special->insert(_mask_token);
 }
 
-void BasicTokenizer::basic_tokenize(const std::string& text,
+void BasicTokenizer::basic_tokenize(const TextView& text,
     std::vector<Token>& tokens) const
 {
   if (tokens.size())
     tokens.clear();
 
   tokens.reserve(text.size());
-  auto matches = _special->parse(text, _max_prefix_matches);
+  auto matches = workspace.cancel ?
+    _special->parse(text.data(), text.size(), _max_prefix_matches, check_cancel) :
+    _special->parse(text.data(), text.size(), _max_prefix_matches);
+#ifdef WITH_STATS
+  workspace.special_matches = matches.size();
+#endif
   if (matches.empty())
   {
     tokenize(text, 0, tokens);
@@ -37,7 +166,7 @@ void BasicTokenizer::basic_tokenize(const std::string& text,
   }
 
   int start = 0;
-  std::string subtext;
+  TextView subtext;
   for (int i = 0; i < matches.size(); i++)
   {
     subtext = text.substr(start, matches[i].first - start);
@@ -64,18 +193,25 @@ BasicTokenizer::basic_tokenize(const std::string& text) const
   return tokens;
 }
 
-void BasicTokenizer::tokenize(const std::string& text, int pos,
+void BasicTokenizer::tokenize(const TextView& text, int pos,
     std::vector<Token>& tokens) const
 {
   int32_t unicode = 0;
   bool last_state = false;
-  auto data = text.c_str();
+  auto data = text.data();
   int i = 0, m = 0, n = 0, start = 0, len = text.size();
+  int next_check = cancel_bytes;
 
-  char* word = new char[len + 1];
-  uint8_t* ch = new uint8_t[8];
+  workspace.word.resize(len + 1);
+  char* word = workspace.word.data();
+  uint8_t ch[8];
   while (i < len)
   {
+    if (i >= next_check)
+    {
+      next_check = i + cancel_bytes;
+      check_cancel();
+    }
     if (isascii(data[i])) 
     {
       if (isalnum(data[i])) 
@@ -140,15 +276,7 @@ void BasicTokenizer::tokenize(const std::string& text, int pos,
       utf8proc_iterate((uint8_t*)word, n, &unicode);
 
       // is chinese character
-      if ((unicode >= 0x4E00 && unicode <= 0x9FFF) ||
-          (unicode >= 0x3400 && unicode <= 0x4DBF) ||
-          (unicode >= 0x20000 && unicode <= 0x2A6DF) ||
-          (unicode >= 0x2A700 && unicode <= 0x2B73F) ||
-          (unicode >= 0x2B740 && unicode <= 0x2B81F) ||
-          (unicode >= 0x2B820 && unicode <= 0x2CEAF) ||
-          (unicode >= 0xF900 && unicode <= 0xFAFF) ||
-          (unicode >= 0x2F800 && unicode <= 0x2FA1F) ||
-          (utf8proc_category_string(unicode)[0] == 'P')) 
+      if (isChinese(unicode) || (utf8proc_category_string(unicode)[0] == 'P')) 
       {
         tokens.emplace_back(pos + start, pos + i, std::string(word, n));
         last_state = false;
@@ -208,8 +336,6 @@ void BasicTokenizer::tokenize(const std::string& text, int pos,
       std::get<2>(tokens.back()).append(word, n);
     }
   }
-  delete []ch;
-  delete []word;
 }
 
 std::string BasicTokenizer::normalize(const uint8_t* str) const
@@ -256,10 +382,23 @@ int BasicTokenizer::isCntrl(int c) const
   return iscntrl(c);
 }
 
+bool BasicTokenizer::isChinese(int32_t c) const
+{
+  return (c >= 0x4E00 && c <= 0x9FFF) ||
+         (c >= 0x3400 && c <= 0x4DBF) ||
+         (c >= 0x20000 && c <= 0x2A6DF) ||
+         (c >= 0x2A700 && c <= 0x2B73F) ||
+         (c >= 0x2B740 && c <= 0x2B81F) ||
+         (c >= 0x2B820 && c <= 0x2CEAF) ||
+         (c >= 0xF900 && c <= 0xFAFF) ||
+         (c >= 0x2F800 && c <= 0x2FA1F);
+}
+
 Tokenizer::Tokenizer(const std::string& vocab_path, bool do_lower_case, bool codepoint_level)
 : BasicTokenizer(do_lower_case), _codepoint_level(codepoint_level)
 {
   _vocab = std::unique_ptr<Trie>(new Trie());
+  _char_ids.assign(_num_char_ids, -1);
   load_vocab(vocab_path);
 
   _pad_id = _vocab->get_index(_pad_token);
@@ -267,6 +406,12 @@ Tokenizer::Tokenizer(const std::string& vocab_path, bool do_lower_case, bool cod
   _sep_id = _vocab->get_index(_sep_token);
   _unk_id = _vocab->get_index(_unk_token);
   _mask_id = _vocab->get_index(_mask_token);
+
+  for (size_t i = 0; i < _special->size(); i++)
+    update_special(_special->key(i));
+#ifdef WITH_STATS
+  _stats.reset(new StatsRegistry());
+#endif
 }
 
 void Tokenizer::load_vocab(const std::string& vocab_path)
@@ -277,10 +422,118 @@ void Tokenizer::load_vocab(const std::string& vocab_path)
   std::string token;
   while (std::getline(ifs, token))
     if (!token.empty())
-      _vocab->insert(token);
+      insert(token);
   ifs.close();
 }
 
+namespace
+{
+
+const char serialize_magic[4] = {'E', 'T', 'O', 'K'};
+const uint32_t serialize_version = 1;
+const size_t serialize_header = 16;
+
+}
+
+Tokenizer::Tokenizer(LoadTag, const char* data, size_t size,
+    const std::shared_ptr<const void>& storage)
+: BasicTokenizer(true)
+{
+  uint32_t version = 0;
+  if (size >= serialize_header)
+    std::memcpy(&version, data + 4, sizeof(version));
+  if (size < serialize_header || std::memcmp(data, serialize_magic, 4) != 0 ||
+      version != serialize_version)
+    throw std::invalid_argument("not a serialized tokenizer!");
+  _do_lower_case = data[8];
+  _codepoint_level = data[9];
+
+  size_t pos = serialize_header;
+  _vocab = std::unique_ptr<Trie>(new Trie());
+  _vocab->load(data, size, pos, storage);
+  _special->load(data, size, pos, storage);
+
+  _char_ids.assign(_num_char_ids, -1);
+  for (size_t i = 0; i < _vocab->size(); i++)
+    update_char_ids(_vocab->key(i), i);
+  _pad_id = _vocab->get_index(_pad_token);
+  _cls_id = _vocab->get_index(_cls_token);
+  _sep_id = _vocab->get_index(_sep_token);
+  _unk_id = _vocab->get_index(_unk_token);
+  _mask_id = _vocab->get_index(_mask_token);
+
+  for (size_t i = 0; i < _special->size(); i++)
+    update_special(_special->key(i));
+#ifdef WITH_STATS
+  _stats.reset(new StatsRegistry());
+#endif
+}
+
+std::string Tokenizer::serialize() const
+{
+  std::string data(serialize_header, '\0');
+  std::memcpy(&data[0], serialize_magic, 4);
+  std::memcpy(&data[4], &serialize_version, sizeof(serialize_version));
+  data[8] = _do_lower_case;
+  data[9] = _codepoint_level;
+  _vocab->save(data);
+  _special->save(data);
+  return data;
+}
+
+std::unique_ptr<Tokenizer> Tokenizer::deserialize(const std::string& data)
+{
+  return std::unique_ptr<Tokenizer>(new Tokenizer(LoadTag(), data.data(), data.size(), nullptr));
+}
+
+void Tokenizer::save(const std::string& path) const
+{
+  std::ofstream ofs(path, std::ios::binary);
+  if (!ofs.is_open())
+    throw std::invalid_argument(path + " can not be opened for saving!");
+  std::string data = serialize();
+  ofs.write(data.data(), data.size());
+  if (!ofs)
+    throw std::runtime_error("failed writing " + path + "!");
+}
+
+std::unique_ptr<Tokenizer> Tokenizer::open(const std::string& path)
+{
+  std::unique_ptr<Tokenizer> tokenizer;
+#ifndef _WIN32
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::invalid_argument(path + " can not be opened for loading!");
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < off_t(serialize_header))
+  {
+    ::close(fd);
+    throw std::invalid_argument(path + " is not a serialized tokenizer!");
+  }
+  size_t size = st.st_size;
+  void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED)
+    throw std::runtime_error("failed mapping " + path + "!");
+  std::shared_ptr<const void> storage(data, [size](const void* p)
+  {
+    munmap(const_cast<void*>(p), size);
+  });
+  tokenizer.reset(new Tokenizer(LoadTag(), static_cast<const char*>(data), size, storage));
+#else
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs.is_open())
+    throw std::invalid_argument(path + " can not be opened for loading!");
+  std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+  tokenizer.reset(new Tokenizer(LoadTag(), data.data(), data.size(), nullptr));
+#endif
+  tokenizer->_path = path;
+  return tokenizer;
+}
+
+const std::string& Tokenizer::path() const
+{ return _path; }
+
 bool Tokenizer::isAlnum(const char* str, int len) const
 {
   for (int i = 0; i < len; i++)
@@ -293,7 +546,7 @@ void Tokenizer::build_pos_map(const char* str, int len,
     std::vector<int>& pos_map) const
 {
   int32_t unicode = 0;
-  uint8_t* ch = new uint8_t[8];
+  uint8_t ch[8];
   int cur = 0, val = 0, m = 0, n = 0;
   while (cur < len)
   {
@@ -342,7 +595,6 @@ void Tokenizer::build_pos_map(const char* str, int len,
     }
   }
   pos_map.emplace_back(val);
-  delete []ch;
 }
 
 int Tokenizer::NFD_codepoint_number(const uint8_t* str) const
@@ -403,12 +655,12 @@ int Tokenizer::get_codepoint_number(const char* str, int len) const
 int Tokenizer::get_codepoint_number(const std::string& token) const
 { return get_codepoint_number(token.data(), token.size()); }
 
-void Tokenizer::build_index_map(const std::string& text, 
+void Tokenizer::build_index_map(const TextView& text, 
     std::vector<int>& byte2index) const
 {
-  auto data = text.c_str();
+  auto data = text.data();
   int cur_bytes = 0, cur_index = 0, len = text.size();
-  byte2index.resize(len + 1, -1);
+  byte2index.assign(len + 1, -1);
   while (cur_bytes < len)
   {
     byte2index[cur_bytes] = cur_index++;
@@ -433,16 +685,50 @@ int Tokenizer::search(const char* str, int len, int index) const
 }
 
 void Tokenizer::insert(const std::string& token)
-{ _vocab->insert(token); }
+{
+  if (_vocab->count(token))
+    return;
+  invalidate();
+  _vocab->insert(token);
+  update_char_ids(token, _vocab->size() - 1);
+}
 
 void Tokenizer::insert(const std::vector<std::string>& tokens)
-{ _vocab->insert(tokens); }
+{
+  for (size_t i = 0; i < tokens.size(); i++)
+    insert(tokens[i]);
+}
 
 void Tokenizer::add_special_tokens(const std::string& token)
-{ _special->insert(token); }
+{
+  invalidate();
+  _special->insert(token);
+  update_special(token);
+}
 
 void Tokenizer::add_special_tokens(const std::vector<std::string>& tokens)
-{ _special->insert(tokens); }
+{
+  for (size_t i = 0; i < tokens.size(); i++)
+    add_special_tokens(tokens[i]);
+}
+
+// encodings cached or saved before a change of the tokens are stale
+void Tokenizer::invalidate()
+{
+  _path.clear();
+  if (_cache)
+    _cache->clear();
+}
+
+void Tokenizer::update_special(const std::string& token)
+{
+  _max_special_len = std::max(_max_special_len, token.size());
+  for (size_t i = 0; i < _special->size() && !_special_overlap; i++)
+  {
+    const std::string& key = _special->key(i);
+    _special_overlap = may_overlap(key, token) || may_overlap(token, key);
+  }
+}
 
 std::string Tokenizer::pad_token() const
 { return _pad_token; }
@@ -486,6 +772,148 @@ int Tokenizer::get_id(const std::string& token) const
   return id < 0 ? _unk_id : id;
 }
 
+void Tokenizer::set_thread_pool(int max_threads, bool pin_threads,
+    size_t queue_capacity)
+{
+  std::lock_guard<std::mutex> lock(_pool_mutex);
+  _pool = std::make_shared<ThreadPool>(std::max(max_threads - 1, 1), pin_threads,
+    queue_capacity);
+}
+
+void Tokenizer::set_thread_pool(const std::shared_ptr<ThreadPool>& pool)
+{
+  std::lock_guard<std::mutex> lock(_pool_mutex);
+  _pool = pool;
+}
+
+std::shared_ptr<ThreadPool> Tokenizer::thread_pool() const
+{
+  std::lock_guard<std::mutex> lock(_pool_mutex);
+  if (!_pool)
+    _pool = std::make_shared<ThreadPool>(0, false, size_t(_max_queued_tasks));
+  return _pool;
+}
+
+void Tokenizer::set_cache(size_t capacity, int num_shards)
+{
+  if (capacity == 0)
+    _cache.reset();
+  else
+    _cache = std::make_shared<EncodeCache>(capacity, num_shards);
+}
+
+std::shared_ptr<EncodeCache> Tokenizer::cache() const
+{ return _cache; }
+
+CacheStats Tokenizer::cache_stats() const
+{ return _cache ? _cache->stats() : CacheStats(); }
+
+MemoryUsage Tokenizer::memory_usage() const
+{
+  MemoryUsage usage;
+  usage.vocab = _vocab->memory_usage();
+  usage.special = _special->memory_usage();
+  usage.char_ids = _char_ids.capacity() * sizeof(int);
+  if (_cache)
+  {
+    CacheStats stats = _cache->stats();
+    usage.cache = stats.bytes;
+    usage.cache_entries = stats.size;
+  }
+
+  auto& registry = workspace_registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  usage.num_workspaces = registry.workspaces.size();
+  for (auto ws : registry.workspaces)
+    usage.workspaces += ws->bytes.load(std::memory_order_relaxed);
+  return usage;
+}
+
+PipelineStats Tokenizer::stats() const
+{ return _stats ? _stats->snapshot() : PipelineStats(); }
+
+void Tokenizer::reset_stats()
+{
+  if (_stats)
+    _stats->reset();
+}
+
+const ParallelCost& Tokenizer::parallel_cost() const
+{
+  std::call_once(_cost_flag, [this]() { calibrate(); });
+  return _cost;
+}
+
+void Tokenizer::calibrate() const
+{
+  // encoding cost on a mixed batch, best of a few rounds
+  const char* samples[] = {
+    "计算机科学与技术（Computer Science and Technology）是一门普通高等学校本科专业。",
+    "The quick brown fox jumps over the lazy dog, unaffable and unbelievable.",
+    "清华大学的计算机科学与技术专业实力全国第一，2022年排名A+。"
+  };
+  std::vector<std::string> texts;
+  size_t num_bytes = 0;
+  for (int i = 0; i < 48; i++)
+  {
+    texts.emplace_back(samples[i % 3]);
+    for (int j = 0; j < i % 4; j++)
+      texts.back().append(samples[(i + j) % 3]);
+    num_bytes += texts.back().size() + _text_overhead;
+  }
+  // bypass the cache, whose hits would make encoding look cheaper, and
+  // keep the rounds out of the stats
+  StatsRegistry::Pause pause;
+  std::vector<int> input_ids, offsets;
+  double best = 0;
+  for (int r = 0; r < 5; r++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < texts.size(); i++)
+      encode_uncached(texts[i], input_ids, offsets, true, true, 512);
+    auto end = std::chrono::steady_clock::now();
+    double t = std::chrono::duration<double, std::nano>(end - start).count();
+    if (r == 0 || t < best)
+      best = t;
+  }
+  _cost.ns_per_byte = best / num_bytes;
+
+  // wake-up and join of pool workers running empty tasks
+  int num_threads = std::min(int(std::thread::hardware_concurrency()), 4);
+  if (num_threads < 2)
+  {
+    _cost.ns_per_thread = std::numeric_limits<double>::infinity();
+    return;
+  }
+  auto pool = thread_pool();
+  pool->reserve(num_threads - 1);
+  best = 0;
+  for (int r = 0; r < 20; r++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    pool->parallel_for(num_threads, num_threads, 1, [](int) {});
+    auto end = std::chrono::steady_clock::now();
+    double t = std::chrono::duration<double, std::nano>(end - start).count();
+    if (r == 0 || t < best)
+      best = t;
+  }
+  _cost.ns_per_thread = best / (num_threads - 1);
+}
+
+int Tokenizer::auto_threads(size_t num_bytes, int num_tasks) const
+{
+  const ParallelCost& cost = parallel_cost();
+  int max_threads = std::min(int(std::thread::hardware_concurrency()), num_tasks);
+  double work = num_bytes * cost.ns_per_byte;
+
+  // add threads while work / t + (t - 1) * ns_per_thread decreases
+  int num_threads = 1;
+  while (num_threads < max_threads &&
+         work / (num_threads * (num_threads + 1.0)) > cost.ns_per_thread)
+    num_threads++;
+  return num_threads;
+}
+
 bool Tokenizer::count(const std::string& token) const
 { return _vocab->count(token); }
 
@@ -520,118 +948,296 @@ void Tokenizer::convert_tokens_to_ids(const std::vector<std::string>& tokens,
     input_ids.emplace_back(_sep_id);
 }
 
-void Tokenizer::wordpiece_tokenize(const std::string& text,
-    std::vector<std::string>& tokens,
-    std::vector<int>& offsets) const
+// token classes used to decide the spacing between decoded tokens
+enum DecodeState { DECODE_START = 0, DECODE_WORD, DECODE_CJK, DECODE_OPEN, 
+  DECODE_CLOSE, DECODE_GLUE };
+
+void Tokenizer::decode_token(int id, int& state, std::string& text,
+    bool skip_special_tokens, bool clean_up_tokenization_spaces) const
 {
-  if (tokens.size())
-    tokens.clear();
-  if (offsets.size())
-    offsets.clear();
-  tokens.reserve(text.size());
-  offsets.reserve(2 * text.size());
+  if (id < 0 || id >= size())
+    throw std::invalid_argument("input id " + std::to_string(id) + " is out of vocabulary!");
 
-  std::vector<Token> base_tokens;
-  basic_tokenize(text, base_tokens);
+  const std::string& token = _vocab->key(id);
+  if (skip_special_tokens && _special->count(token))
+    return;
 
-  std::vector<int> byte2index;
+  auto data = token.data();
+  int len = token.size();
+  bool is_subword = len > 2 && data[0] == '#' && data[1] == '#';
+  if (is_subword)
+  {
+    data += 2;
+    len -= 2;
+  }
+
+  // classify single-codepoint tokens
+  int cur = DECODE_WORD;
+  if (clean_up_tokenization_spaces && len > 0 && 
+      get_num_bytes_of_utf8_char(data, len) == len)
+  {
+    if (len == 1)
+    {
+      if (strchr(".,!?;:)]}%", data[0]))
+        cur = DECODE_CLOSE;
+      else if (strchr("([{", data[0]))
+        cur = DECODE_OPEN;
+      else if (data[0] == '\'')
+        cur = DECODE_GLUE;
+    }
+    else
+    {
+      int32_t unicode = 0;
+      utf8proc_iterate((const uint8_t*)data, len, &unicode);
+      if (isChinese(unicode) || utf8proc_category_string(unicode)[0] == 'P')
+        cur = DECODE_CJK;
+    }
+  }
+
+  bool space = state != DECODE_START && !is_subword;
+  if (space && clean_up_tokenization_spaces)
+    space = !((state == DECODE_CJK && cur == DECODE_CJK) ||
+              state == DECODE_OPEN || state == DECODE_GLUE ||
+              cur == DECODE_CLOSE || cur == DECODE_GLUE);
+  if (space)
+    text.push_back(' ');
+  text.append(data, len);
+  state = cur;
+}
+
+void Tokenizer::decode(const std::vector<int>& input_ids,
+    std::string& text,
+    bool skip_special_tokens,
+    bool clean_up_tokenization_spaces) const
+{
+  if (text.size())
+    text.clear();
+
+  // upper bound of the decoded length
+  size_t capacity = 0;
+  for (size_t i = 0; i < input_ids.size(); i++)
+    if (input_ids[i] >= 0 && input_ids[i] < size())
+      capacity += _vocab->key(input_ids[i]).size() + 1;
+  text.reserve(capacity);
+
+  int state = DECODE_START;
+  for (size_t i = 0; i < input_ids.size(); i++)
+    decode_token(input_ids[i], state, text, skip_special_tokens, 
+      clean_up_tokenization_spaces);
+}
+
+std::string Tokenizer::decode(const std::vector<int>& input_ids,
+    bool skip_special_tokens,
+    bool clean_up_tokenization_spaces) const
+{
+  std::string text;
+  decode(input_ids, text, skip_special_tokens, clean_up_tokenization_spaces);
+  return text;
+}
+
+void Tokenizer::batch_decode(const std::vector<std::vector<int>>& input_ids,
+    std::vector<std::string>& texts,
+    int num_threads,
+    bool skip_special_tokens,
+    bool clean_up_tokenization_spaces) const
+{
+  if (texts.size())
+    texts.clear();
+  texts.resize(input_ids.size());
+  parallel_for(input_ids.size(), num_threads, [&](int i)
+  {
+    decode(input_ids[i], texts[i], skip_special_tokens, 
+      clean_up_tokenization_spaces);
+  }, [&](int i) { return input_ids[i].size() + _text_overhead; });
+}
+
+DecodeStream::DecodeStream(const Tokenizer& tokenizer,
+    bool skip_special_tokens, bool clean_up_tokenization_spaces)
+: _tokenizer(tokenizer), _skip_special_tokens(skip_special_tokens),
+  _clean_up_tokenization_spaces(clean_up_tokenization_spaces),
+  _state(DECODE_START) {}
+
+void DecodeStream::step(int id, std::string& text)
+{
+  // the spacing before a token only depends on the previous token class,
+  // so every token is final as soon as it arrives
+  _tokenizer.decode_token(id, _state, text, _skip_special_tokens,
+    _clean_up_tokenization_spaces);
+}
+
+std::string DecodeStream::step(int id)
+{
+  std::string text;
+  step(id, text);
+  return text;
+}
+
+void DecodeStream::reset()
+{ _state = DECODE_START; }
+
+int Tokenizer::lookup(const std::string& token) const
+{
+  // single codepoint tokens are resolved by the direct-indexed table
+  auto data = (const uint8_t*)token.data();
+  int32_t unicode = -1;
+  switch (token.size())
+  {
+    case 1:
+      if (data[0] < 0x80)
+        unicode = data[0];
+      break;
+    case 2:
+      if ((data[0] & 0xE0) == 0xC0 && (data[1] & 0xC0) == 0x80)
+        unicode = ((data[0] & 0x1F) << 6) | (data[1] & 0x3F);
+      break;
+    case 3:
+      if ((data[0] & 0xF0) == 0xE0 && (data[1] & 0xC0) == 0x80 &&
+          (data[2] & 0xC0) == 0x80)
+        unicode = ((data[0] & 0x0F) << 12) | ((data[1] & 0x3F) << 6) |
+                  (data[2] & 0x3F);
+      break;
+  }
+  // overlong and surrogate encodings are left to the trie
+  if ((token.size() == 1 && unicode >= 0) ||
+      (token.size() == 2 && unicode >= 0x80) ||
+      (token.size() == 3 && unicode >= 0x800 && 
+       (unicode < 0xD800 || unicode > 0xDFFF)))
+    return _char_ids[unicode];
+  return _vocab->get_index(token);
+}
+
+void Tokenizer::update_char_ids(const std::string& token, int id)
+{
+  int32_t unicode = 0;
+  auto len = utf8proc_iterate((const uint8_t*)token.data(), token.size(), &unicode);
+  if (len > 0 && len == utf8proc_ssize_t(token.size()) && unicode < _num_char_ids)
+    _char_ids[unicode] = id;
+}
+
+void Tokenizer::wordpiece(const TextView& text,
+    std::vector<int>& input_ids,
+    std::vector<std::string>* tokens,
+    std::vector<int>& offsets) const
+{
+  auto& base_tokens = workspace.base_tokens;
+  {
+    STATS_TIMER(STAGE_BASIC_TOKENIZE);
+    basic_tokenize(text, base_tokens);
+  }
+  STATS_TIMER(STAGE_WORDPIECE);
+#ifdef WITH_STATS
+  size_t first_id = input_ids.size();
+#endif
+
+  auto& byte2index = workspace.byte2index;
   if (_codepoint_level)
     build_index_map(text, byte2index);
 
+  auto add_offsets = [&](int a, int b)
+  {
+    if (_codepoint_level)
+    {
+      offsets.emplace_back(byte2index[a]);
+      offsets.emplace_back(byte2index[b]);
+    }
+    else
+    {
+      offsets.emplace_back(a);
+      offsets.emplace_back(b);
+    }
+  };
+
   bool is_bad = false;
-  auto data = text.c_str();
-  int start = 0, end = 0, cur = 0, pos = 0, len = 0, num = 0;
-  std::string token, prefix, subtoken;
-  std::vector<int> pos_map;
-  std::vector<Token> sub_tokens;
+  auto data = text.data();
+  int start = 0, end = 0, cur = 0, pos = 0, len = 0, num = 0, id = 0;
+  size_t prefix_len = 0;
+  auto& subtoken = workspace.subtoken;
+  auto& pos_map = workspace.pos_map;
+  auto& sub_tokens = workspace.sub_tokens;
   pos_map.reserve(_max_input_chars_per_word);
   sub_tokens.reserve(_max_input_chars_per_word);
-  for (int i = 0; i < base_tokens.size(); i++) 
+  subtoken.reserve(_max_input_chars_per_word + 2);
+  for (size_t i = 0; i < base_tokens.size(); i++) 
   {
+    if (i % cancel_tokens == cancel_tokens - 1)
+      check_cancel();
     start = std::get<0>(base_tokens[i]);
     end   = std::get<1>(base_tokens[i]);
-    token = std::get<2>(base_tokens[i]);
+    const std::string& token = std::get<2>(base_tokens[i]);
     
-    if (_special->count(token) || _vocab->count(token)) 
+    id = lookup(token);
+    if (id >= 0 || _special->count(token)) 
     {
-      tokens.emplace_back(token);
-      if (_codepoint_level)
-      {
-        offsets.emplace_back(byte2index[start]);
-        offsets.emplace_back(byte2index[end]);
-      }
-      else
-      {
-        offsets.emplace_back(start);
-        offsets.emplace_back(end);
-      }
+      input_ids.emplace_back(id >= 0 ? id : _unk_id);
+      if (tokens)
+        tokens->emplace_back(token);
+      add_offsets(start, end);
       continue;
     }
 
     if (token.size() > _max_input_chars_per_word)
     {
-      tokens.emplace_back(_unk_token);
-      if (_codepoint_level)
-      {
-        offsets.emplace_back(byte2index[start]);
-        offsets.emplace_back(byte2index[end]);
-      }
-      else
-      {
-        offsets.emplace_back(start);
-        offsets.emplace_back(end);
-      }
+      input_ids.emplace_back(_unk_id);
+      if (tokens)
+        tokens->emplace_back(_unk_token);
+      add_offsets(start, end);
       continue;
     }
 
-    // wordpiece tokenize
+    // wordpiece tokenize, continuation pieces are searched in place 
+    // by overwriting the two consumed bytes before cur with "##"
     cur = 0;
     pos = 0;
     is_bad = false;
     sub_tokens.clear();
+    subtoken.assign("##");
+    subtoken.append(token);
     while (cur < token.size()) 
     {
-      subtoken = token.substr(cur);
-      if (cur > 0)  
-        subtoken = "##" + subtoken;
+      if (cur > 0)
+      {
+        subtoken[cur] = '#';
+        subtoken[cur + 1] = '#';
+        id = _vocab->max_prefix(subtoken.data() + cur, token.size() - cur + 2,
+          prefix_len);
+      }
+      else
+        id = _vocab->max_prefix(subtoken.data() + 2, token.size(), prefix_len);
 
-      prefix = _vocab->max_prefix(subtoken, _max_prefix_matches);
-      if ((cur > 0 && prefix.size() < 3) || prefix.empty()) 
+      if (id < 0 || (cur > 0 && prefix_len < 3)) 
       {
         is_bad = true;
         break;
       }
 
-      len = cur > 0 ? (prefix.size() - 2) : prefix.size();
-      num = cur > 0 ? get_codepoint_number(prefix) - 2 :
-                      get_codepoint_number(prefix);
+      len = cur > 0 ? (prefix_len - 2) : prefix_len;
+      num = get_codepoint_number(subtoken.data() + cur + 2, len);
       
-      sub_tokens.emplace_back(pos, pos + num, prefix);
+      sub_tokens.emplace_back(pos, pos + num, id);
       cur += len;
       pos += num;
     }
 
     if (is_bad) 
     {
-      tokens.emplace_back(_unk_token);
-      if (_codepoint_level)
-      {
-        offsets.emplace_back(byte2index[start]);
-        offsets.emplace_back(byte2index[end]);
-      }
-      else
-      {
-        offsets.emplace_back(start);
-        offsets.emplace_back(end);
-      }
+      input_ids.emplace_back(_unk_id);
+      if (tokens)
+        tokens->emplace_back(_unk_token);
+      add_offsets(start, end);
       continue;
     }
 
+    for (size_t j = 0; j < sub_tokens.size(); j++)
+    {
+      input_ids.emplace_back(std::get<2>(sub_tokens[j]));
+      if (tokens)
+        tokens->emplace_back(_vocab->key(std::get<2>(sub_tokens[j])));
+    }
+
     if (isAlnum(data + start, end - start))
     {
-      for (int j = 0; j < sub_tokens.size(); j++)
+      for (size_t j = 0; j < sub_tokens.size(); j++)
       {
-        tokens.emplace_back(std::get<2>(sub_tokens[j]));
         if (_codepoint_level)
         {
           offsets.emplace_back(byte2index[start] + std::get<0>(sub_tokens[j]));
@@ -648,14 +1254,13 @@ void Tokenizer::wordpiece_tokenize(const std::string& text,
 
     pos_map.clear();
     build_pos_map(data + start, end - start, pos_map);
-    for (int j = 0; j < sub_tokens.size(); j++)
+    for (size_t j = 0; j < sub_tokens.size(); j++)
     {
       auto a = std::get<0>(sub_tokens[j]);
       auto b = std::get<1>(sub_tokens[j]);
       b = (pos_map[a] == pos_map[b]) ? (pos_map[a] + 1) : pos_map[b];
       a = pos_map[a];
 
-      tokens.emplace_back(std::get<2>(sub_tokens[j]));
       if (_codepoint_level)
       {
         offsets.emplace_back(byte2index[start] + a);
@@ -668,6 +1273,47 @@ void Tokenizer::wordpiece_tokenize(const std::string& text,
       }
     }
   }
+#ifdef WITH_STATS
+  count_wordpieces(input_ids, first_id);
+#endif
+  workspace.trim();
+}
+
+#ifdef WITH_STATS
+void Tokenizer::count_wordpieces(const std::vector<int>& input_ids, size_t first) const
+{
+  // words over _max_input_chars_per_word bytes fall back to [UNK] unless 
+  // they are tokens themselves
+  const auto& base_tokens = workspace.base_tokens;
+  size_t num_long = 0;
+  for (size_t i = 0; i < base_tokens.size(); i++)
+  {
+    const std::string& token = std::get<2>(base_tokens[i]);
+    num_long += token.size() > _max_input_chars_per_word && lookup(token) < 0 &&
+      !_special->count(token);
+  }
+  STATS_ADD(STATS_BASE_TOKENS, base_tokens.size());
+  STATS_ADD(STATS_WORDPIECES, input_ids.size() - first);
+  STATS_ADD(STATS_UNKNOWN_TOKENS, std::count(input_ids.begin() + first, input_ids.end(), _unk_id));
+  STATS_ADD(STATS_LONG_WORDS, num_long);
+  STATS_ADD(STATS_SPECIAL_TOKENS, workspace.special_matches);
+}
+#endif
+
+void Tokenizer::wordpiece_tokenize(const std::string& text,
+    std::vector<std::string>& tokens,
+    std::vector<int>& offsets) const
+{
+  if (tokens.size())
+    tokens.clear();
+  if (offsets.size())
+    offsets.clear();
+  tokens.reserve(text.size());
+  offsets.reserve(2 * text.size());
+
+  std::vector<int> input_ids;
+  input_ids.reserve(text.size());
+  wordpiece(text, input_ids, &tokens, offsets);
 }
 
 std::vector<std::string> 
@@ -679,74 +1325,339 @@ Tokenizer::wordpiece_tokenize(const std::string& text) const
   return tokens;
 }
 
-void Tokenizer::encode(const std::string& text,
-    std::vector<int>& input_ids,
-    std::vector<int>& attention_mask,
-    std::vector<int>& offsets,
+namespace
+{
+
+// concatenate rows into flat, row i at [row_offsets[i], row_offsets[i + 1])
+template <typename T>
+void concat_rows(std::vector<std::vector<T>>& rows, std::vector<T>& flat,
+    std::vector<size_t>& row_offsets)
+{
+  row_offsets.assign(rows.size() + 1, 0);
+  for (size_t i = 0; i < rows.size(); i++)
+    row_offsets[i + 1] = row_offsets[i] + rows[i].size();
+  flat.clear();
+  flat.reserve(row_offsets.back());
+  for (size_t i = 0; i < rows.size(); i++)
+    flat.insert(flat.end(), std::make_move_iterator(rows[i].begin()),
+      std::make_move_iterator(rows[i].end()));
+}
+
+}
+
+void Tokenizer::batch_tokenize(const std::vector<std::string>& texts,
+    std::vector<std::string>& tokens,
+    std::vector<size_t>& row_offsets,
+    int num_threads) const
+{
+  std::vector<std::vector<std::string>> rows(texts.size());
+  parallel_for(texts.size(), num_threads, [&](int i)
+  {
+    workspace.input_ids.clear();
+    workspace.offsets.clear();
+    wordpiece(texts[i], workspace.input_ids, &rows[i], workspace.offsets);
+  }, [&](int i) { return texts[i].size() + _text_overhead; });
+  concat_rows(rows, tokens, row_offsets);
+}
+
+void Tokenizer::batch_convert_ids_to_tokens(const std::vector<std::vector<int>>& input_ids,
+    std::vector<std::string>& tokens,
+    std::vector<size_t>& row_offsets,
+    int num_threads) const
+{
+  std::vector<std::vector<std::string>> rows(input_ids.size());
+  parallel_for(input_ids.size(), num_threads, [&](int i)
+  {
+    rows[i] = convert_ids_to_tokens(input_ids[i]);
+  }, [&](int i) { return input_ids[i].size() + _text_overhead; });
+  concat_rows(rows, tokens, row_offsets);
+}
+
+void Tokenizer::batch_convert_tokens_to_ids(const std::vector<std::vector<std::string>>& tokens,
+    std::vector<int>& input_ids,
+    std::vector<size_t>& row_offsets,
+    int num_threads,
+    bool add_cls_sep) const
+{
+  std::vector<std::vector<int>> rows(tokens.size());
+  parallel_for(tokens.size(), num_threads, [&](int i)
+  {
+    rows[i].reserve(tokens[i].size() + 2);
+    convert_tokens_to_ids(tokens[i], rows[i], add_cls_sep);
+  }, [&](int i) { return tokens[i].size() + _text_overhead; });
+  concat_rows(rows, input_ids, row_offsets);
+}
+
+void Tokenizer::count_tokens(const std::vector<std::string>& texts,
+    std::vector<int>& counts,
+    int num_threads,
+    bool add_cls_sep) const
+{
+  counts.assign(texts.size(), 0);
+  parallel_for(texts.size(), num_threads, [&](int i)
+  {
+    // counted encodings are not kept, only a cached one is reused
+    encode_row(texts[i], workspace.input_ids, workspace.offsets, add_cls_sep, false, 0, false);
+    counts[i] = workspace.input_ids.size();
+  }, [&](int i) { return texts[i].size() + _text_overhead; });
+}
+
+bool Tokenizer::encode_row(const TextView& text,
+    std::vector<int>& input_ids,
+    std::vector<int>& offsets,
+    bool add_cls_sep,
+    bool truncation,
+    int max_length,
+    bool update_cache) const
+{
+  STATS_TIMER(STAGE_ENCODE);
+  STATS_ADD(STATS_TEXTS, 1);
+  STATS_ADD(STATS_BYTES, text.size());
+  int options = 0;
+  bool truncated = false;
+  if (_cache)
+  {
+    options = EncodeCache::options(add_cls_sep, truncation, max_length);
+    if (_cache->get(text, options, input_ids, offsets, truncated))
+    {
+      STATS_ADD(STATS_CACHE_HITS, 1);
+      STATS_ADD(STATS_TRUNCATIONS, truncated);
+      return truncated;
+    }
+    STATS_ADD(STATS_CACHE_MISSES, 1);
+  }
+
+  truncated = encode_uncached(text, input_ids, offsets, add_cls_sep, truncation, max_length);
+  if (_cache && update_cache)
+    _cache->put(text, options, input_ids, offsets, truncated);
+  return truncated;
+}
+
+bool Tokenizer::encode_uncached(const TextView& text,
+    std::vector<int>& input_ids,
+    std::vector<int>& offsets,
     bool add_cls_sep,
     bool truncation,
     int max_length) const
 {
   if (input_ids.size())
     input_ids.clear();
-  if (attention_mask.size())
-    attention_mask.clear();
   if (offsets.size())
     offsets.clear();
 
-  std::vector<std::string> tokens;
-  wordpiece_tokenize(text, tokens, offsets);
-
   // input_ids
-  int n = tokens.size();
-  int capacity = std::max(max_length, n + 2);
+  int capacity = std::max(max_length, int(text.size() + 2));
   input_ids.reserve(capacity);
-  convert_tokens_to_ids(tokens, input_ids, add_cls_sep);
+  offsets.reserve(2 * text.size());
+  if (add_cls_sep)
+    input_ids.emplace_back(_cls_id);
+  wordpiece(text, input_ids, nullptr, offsets);
+  if (add_cls_sep)
+    input_ids.emplace_back(_sep_id);
   
   // truncation
-  if (truncation && input_ids.size() > max_length)
+  bool truncated = truncation && truncate(input_ids, offsets, add_cls_sep, max_length);
+  STATS_ADD(STATS_TRUNCATIONS, truncated);
+  return truncated;
+}
+
+bool Tokenizer::truncate(std::vector<int>& input_ids,
+    std::vector<int>& offsets,
+    bool add_cls_sep,
+    int max_length) const
+{
+  if (input_ids.size() <= max_length)
+    return false;
+  int n = 2 * max_length;
+  if (add_cls_sep)
+    n -= 4;
+  input_ids.resize(max_length);
+  offsets.resize(n);
+  if (add_cls_sep)
+    input_ids[max_length - 1] = _sep_id;
+  return true;
+}
+
+size_t Tokenizer::next_split(const std::string& text, size_t pos) const
+{
+  // tokenization restarts after ascii punctuation or spaces, CJK characters
+  // and unicode punctuation, if no match of special tokens spans the point
+  auto data = text.data();
+  size_t len = text.size();
+  int32_t unicode = 0;
+  for (size_t i = std::max(pos, size_t(1)); i < len; i++)
   {
-    n = 2 * max_length;
-    if (add_cls_sep)
-      n -= 4;
-    input_ids.resize(max_length);
-    offsets.resize(n);
-    if (add_cls_sep)
-      input_ids[max_length - 1] = _sep_id;
-    if (input_ids.capacity() > max_length * 4)
-      std::vector<int>(input_ids).swap(input_ids);
-  }  
+    if ((data[i] & 0xC0) == 0x80)
+      continue;
+    if (isascii(data[i - 1]))
+    {
+      if (isalnum(data[i - 1]) || isCntrl(data[i - 1]))
+        continue;
+    }
+    else
+    {
+      size_t start = i - 1;
+      while (start > 0 && (data[start] & 0xC0) == 0x80)
+        start--;
+      auto n = utf8proc_iterate((const uint8_t*)data + start, i - start, &unicode);
+      if (n != utf8proc_ssize_t(i - start) || !(isChinese(unicode) || 
+          utf8proc_category_string(unicode)[0] == 'P'))
+        continue;
+    }
+
+    size_t start = i > _max_special_len ? i - _max_special_len : 0;
+    while (start > 0 && (data[start] & 0xC0) == 0x80)
+      start--;
+    auto matches = _special->parse(text.substr(start, i - start + _max_special_len),
+      _max_prefix_matches);
+    bool spanned = false;
+    for (size_t j = 0; j < matches.size() && !spanned; j++)
+      spanned = start + matches[j].first < i && 
+        start + matches[j].first + matches[j].second.size() > i;
+    if (!spanned)
+      return i;
+  }
+  return len;
+}
+
+void Tokenizer::encode(const std::string& text,
+    std::vector<int>& input_ids,
+    std::vector<int>& attention_mask,
+    std::vector<int>& offsets,
+    bool add_cls_sep,
+    bool truncation,
+    int max_length) const
+{
+  encode_masked_row(text, input_ids, attention_mask, offsets, add_cls_sep,
+    truncation, max_length);
+}
+
+void Tokenizer::encode_masked_row(const TextView& text,
+    std::vector<int>& input_ids,
+    std::vector<int>& attention_mask,
+    std::vector<int>& offsets,
+    bool add_cls_sep,
+    bool truncation,
+    int max_length) const
+{
+  if (attention_mask.size())
+    attention_mask.clear();
+
+  bool truncated = encode_row(text, input_ids, offsets, add_cls_sep, 
+    truncation, max_length);
+  if (truncated && input_ids.capacity() > max_length * 4)
+    std::vector<int>(input_ids).swap(input_ids);
   
   // attention_mask
-  n = input_ids.size();
-  capacity = std::max(max_length, n);
+  int n = input_ids.size();
+  int capacity = std::max(max_length, n);
   attention_mask.reserve(capacity);
   attention_mask.resize(n, 1);
 }
 
+void Tokenizer::encode_parallel(const std::string& text,
+    std::vector<int>& input_ids,
+    std::vector<int>& attention_mask,
+    std::vector<int>& offsets,
+    int num_threads,
+    bool add_cls_sep,
+    bool truncation,
+    int max_length) const
+{
+  if (num_threads == AUTO_THREADS)
+    num_threads = auto_threads(text.size(), text.size() / _min_segment_bytes);
+  int num_segments = std::min(size_t(std::max(num_threads, 1)) * _chunks_per_thread,
+    text.size() / _min_segment_bytes);
+  if (num_threads <= 1 || num_segments <= 1 || _special_overlap)
+  {
+    encode(text, input_ids, attention_mask, offsets, add_cls_sep, truncation,
+      max_length);
+    return;
+  }
+  STATS_ADD(STATS_TEXTS, 1);
+  STATS_ADD(STATS_BYTES, text.size());
+
+  std::vector<size_t> bounds(1, 0);
+  for (int k = 1; k < num_segments; k++)
+  {
+    size_t pos = std::max(text.size() * k / num_segments, bounds.back() + 1);
+    pos = next_split(text, pos);
+    if (pos >= text.size())
+      break;
+    bounds.emplace_back(pos);
+  }
+  bounds.emplace_back(text.size());
+
+  // segment offsets are made global with the number of bytes or 
+  // codepoints before each segment
+  num_segments = bounds.size() - 1;
+  std::vector<std::vector<int>> segment_ids(num_segments);
+  std::vector<std::vector<int>> segment_offsets(num_segments);
+  std::vector<int> segment_sizes(num_segments);
+  parallel_for(num_segments, num_threads, [&](int k)
+  {
+    TextView segment = TextView(text).substr(bounds[k], bounds[k + 1] - bounds[k]);
+    segment_ids[k].reserve(segment.size());
+    segment_offsets[k].reserve(2 * segment.size());
+    wordpiece(segment, segment_ids[k], nullptr, segment_offsets[k]);
+    segment_sizes[k] = _codepoint_level ?
+      get_codepoint_number(segment.data(), segment.size()) : segment.size();
+  }, [&](int k) { return bounds[k + 1] - bounds[k]; });
+
+  size_t num_ids = 0;
+  for (int k = 0; k < num_segments; k++)
+    num_ids += segment_ids[k].size();
+  if (input_ids.size())
+    input_ids.clear();
+  if (offsets.size())
+    offsets.clear();
+  input_ids.reserve(num_ids + 2);
+  offsets.reserve(2 * num_ids);
+  if (add_cls_sep)
+    input_ids.emplace_back(_cls_id);
+  int base = 0;
+  for (int k = 0; k < num_segments; k++)
+  {
+    input_ids.insert(input_ids.end(), segment_ids[k].begin(), segment_ids[k].end());
+    for (size_t j = 0; j < segment_offsets[k].size(); j++)
+      offsets.emplace_back(base + segment_offsets[k][j]);
+    base += segment_sizes[k];
+  }
+  if (add_cls_sep)
+    input_ids.emplace_back(_sep_id);
+  bool truncated = truncation && truncate(input_ids, offsets, add_cls_sep, max_length);
+  STATS_ADD(STATS_TRUNCATIONS, truncated);
+  if (truncated && input_ids.capacity() > size_t(max_length) * 4)
+    std::vector<int>(input_ids).swap(input_ids);
+
+  if (attention_mask.size())
+    attention_mask.clear();
+  attention_mask.resize(input_ids.size(), 1);
+}
+
 std::vector<int> Tokenizer::encode(const std::string& text, 
     bool add_cls_sep, 
     bool truncation, 
     int max_length) const
 {
-  auto tokens = std::move(wordpiece_tokenize(text));
-  int capacity = std::max(max_length, int(tokens.size() + 2));
   std::vector<int> input_ids;
-  input_ids.reserve(capacity);
-  convert_tokens_to_ids(tokens, input_ids, add_cls_sep);
-
-  // truncation
-  if (truncation && input_ids.size() > max_length)
-  {
-    input_ids.resize(max_length);
-    if (add_cls_sep)
-      input_ids[max_length - 1] = _sep_id;
-    if (input_ids.capacity() > max_length * 4)
-      std::vector<int>(input_ids).swap(input_ids);
-  }
+  bool truncated = encode_row(text, input_ids, workspace.offsets, add_cls_sep,
+    truncation, max_length);
+  if (truncated && input_ids.capacity() > max_length * 4)
+    std::vector<int>(input_ids).swap(input_ids);
   return input_ids;
 }
 
+namespace
+{
+
+std::vector<TextView> views_of(const std::vector<std::string>& texts)
+{
+  return std::vector<TextView>(texts.begin(), texts.end());
+}
+
+}
+
 void Tokenizer::encode(const std::vector<std::string>& texts,
     std::vector<std::vector<int>>& input_ids,
     std::vector<std::vector<int>>& attention_mask,
@@ -758,6 +1669,22 @@ void Tokenizer::encode(const std::vector<std::string>& texts,
     bool truncation,
     int max_length) const
 {
+  encode(views_of(texts), input_ids, attention_mask, offsets, num_threads, add_cls_sep,
+    padding, padding_to_max_length, truncation, max_length);
+}
+
+void Tokenizer::encode(const std::vector<TextView>& texts,
+    std::vector<std::vector<int>>& input_ids,
+    std::vector<std::vector<int>>& attention_mask,
+    std::vector<std::vector<int>>& offsets,
+    int num_threads,
+    bool add_cls_sep,
+    bool padding,
+    bool padding_to_max_length,
+    bool truncation,
+    int max_length) const
+{
+  STATS_TIMER(STAGE_BATCH);
   if (input_ids.size())
     input_ids.clear();
   if (attention_mask.size())
@@ -771,55 +1698,669 @@ void Tokenizer::encode(const std::vector<std::string>& texts,
   attention_mask.resize(n);
   offsets.resize(n);
   
-  if (num_threads <= 1)
-    for (int i = 0; i < n; i++)
+  // identical texts are encoded once and copied
+  std::vector<int> unique, source;
+  bool dedup = find_duplicates(texts, unique, source);
+  parallel_for(dedup ? unique.size() : n, num_threads, [&](int k)
+  {
+    int i = dedup ? unique[k] : k;
+    encode_masked_row(texts[i], input_ids[i], attention_mask[i], offsets[i],
+      add_cls_sep, truncation, max_length);
+  }, [&](int k) { return texts[dedup ? unique[k] : k].size() + _text_overhead; });
+  for (int i = 0; dedup && i < n; i++)
+    if (source[i] != i)
+    {
+      input_ids[i] = input_ids[source[i]];
+      attention_mask[i] = attention_mask[source[i]];
+      offsets[i] = offsets[source[i]];
+    }
+
+  if (padding)
+    pad(input_ids, attention_mask, padding_to_max_length, max_length);
+}
+
+void Tokenizer::encode(const std::vector<std::string>& texts,
+    std::vector<std::vector<int>>& input_ids,
+    std::vector<std::vector<int>>& attention_mask,
+    std::vector<std::vector<int>>& offsets,
+    std::vector<int>& completed,
+    const CancelToken& cancel,
+    int num_threads,
+    bool add_cls_sep,
+    bool padding,
+    bool padding_to_max_length,
+    bool truncation,
+    int max_length) const
+{
+  STATS_TIMER(STAGE_BATCH);
+  if (input_ids.size())
+    input_ids.clear();
+  if (attention_mask.size())
+    attention_mask.clear();
+  if (offsets.size())
+    offsets.clear();
+
+  int n = texts.size();
+  input_ids.resize(n);
+  attention_mask.resize(n);
+  offsets.resize(n);
+  completed.assign(n, 0);
+
+  parallel_for(n, num_threads, [&](int i)
+  {
+    if (cancel.cancelled())
+      return;
+    CancelScope scope(&cancel);
+    try
+    {
       encode(texts[i], input_ids[i], attention_mask[i], offsets[i],
         add_cls_sep, truncation, max_length);
-  else
+      completed[i] = 1;
+    }
+    catch (const CancelledError&)
+    {
+      input_ids[i].clear();
+      attention_mask[i].clear();
+      offsets[i].clear();
+    }
+  }, [&](int i) { return texts[i].size() + _text_overhead; });
+
+  if (padding)
+    pad(input_ids, attention_mask, padding_to_max_length, max_length);
+}
+
+namespace
+{
+
+// copy one encoded row into its slot of the row-major buffers
+void write_row(const std::vector<int>& ids, const std::vector<int>& offs,
+    int seq_len, int pad_id, int* input_ids, int* attention_mask, int* offsets)
+{
+  int n = std::min(int(ids.size()), seq_len);
+  std::copy(ids.begin(), ids.begin() + n, input_ids);
+  std::fill(input_ids + n, input_ids + seq_len, pad_id);
+  if (attention_mask)
   {
-    // Multithreading Implementation
-    #ifdef WITH_OMP
-    #pragma omp parallel for num_threads(num_threads)
-    for (int i = 0; i < n; i++)
-      encode(texts[i], input_ids[i], attention_mask[i], offsets[i], 
+    std::fill(attention_mask, attention_mask + n, 1);
+    std::fill(attention_mask + n, attention_mask + seq_len, 0);
+  }
+  if (offsets)
+  {
+    int m = std::min(int(offs.size()), 2 * seq_len);
+    std::copy(offs.begin(), offs.begin() + m, offsets);
+    std::fill(offsets + m, offsets + 2 * seq_len, 0);
+  }
+}
+
+}
+
+void Tokenizer::encode_batch_into(const std::vector<std::string>& texts,
+    int* input_ids,
+    int* attention_mask,
+    int* offsets,
+    int* lengths,
+    int num_threads,
+    bool add_cls_sep,
+    int max_length) const
+{
+  encode_batch_into(views_of(texts), input_ids, attention_mask, offsets, lengths,
+    num_threads, add_cls_sep, max_length);
+}
+
+void Tokenizer::encode_batch_into(const std::vector<TextView>& texts,
+    int* input_ids,
+    int* attention_mask,
+    int* offsets,
+    int* lengths,
+    int num_threads,
+    bool add_cls_sep,
+    int max_length) const
+{
+  STATS_TIMER(STAGE_BATCH);
+  std::vector<int> unique, source;
+  bool dedup = find_duplicates(texts, unique, source);
+  parallel_for(dedup ? unique.size() : texts.size(), num_threads, [&](int k)
+  {
+    int i = dedup ? unique[k] : k;
+    encode_row(texts[i], workspace.input_ids, workspace.offsets, add_cls_sep,
+      true, max_length);
+    size_t row = size_t(i) * max_length;
+    write_row(workspace.input_ids, workspace.offsets, max_length, _pad_id, 
+      input_ids + row, attention_mask ? attention_mask + row : nullptr,
+      offsets ? offsets + 2 * row : nullptr);
+    if (lengths)
+      lengths[i] = workspace.input_ids.size();
+  }, [&](int k) { return texts[dedup ? unique[k] : k].size() + _text_overhead; });
+
+  // copy the rows of duplicates
+  for (int i = 0; dedup && i < int(texts.size()); i++)
+  {
+    if (source[i] == i)
+      continue;
+    size_t row = size_t(i) * max_length, from = size_t(source[i]) * max_length;
+    std::copy(input_ids + from, input_ids + from + max_length, input_ids + row);
+    if (attention_mask)
+      std::copy(attention_mask + from, attention_mask + from + max_length,
+        attention_mask + row);
+    if (offsets)
+      std::copy(offsets + 2 * from, offsets + 2 * (from + max_length), offsets + 2 * row);
+    if (lengths)
+      lengths[i] = lengths[source[i]];
+  }
+}
+
+void Tokenizer::encode_batch_into(const std::vector<std::string>& texts,
+    BatchEncoding& encoding,
+    int num_threads,
+    bool add_cls_sep,
+    bool padding_to_max_length,
+    bool truncation,
+    int max_length) const
+{
+  encode_batch(views_of(texts), encoding, num_threads, add_cls_sep, padding_to_max_length,
+    truncation, max_length, nullptr);
+}
+
+void Tokenizer::encode_batch_into(const std::vector<TextView>& texts,
+    BatchEncoding& encoding,
+    int num_threads,
+    bool add_cls_sep,
+    bool padding_to_max_length,
+    bool truncation,
+    int max_length) const
+{
+  encode_batch(texts, encoding, num_threads, add_cls_sep, padding_to_max_length,
+    truncation, max_length, nullptr);
+}
+
+void Tokenizer::encode_batch(const std::vector<TextView>& texts,
+    BatchEncoding& encoding,
+    int num_threads,
+    bool add_cls_sep,
+    bool padding_to_max_length,
+    bool truncation,
+    int max_length,
+    const CancelToken* cancel) const
+{
+  if (cancel && cancel->cancelled())
+    throw CancelledError();
+  int n = texts.size();
+  encoding.batch_size = n;
+  encoding.lengths.resize(n);
+  if (padding_to_max_length && !cancel)
+  {
+    encoding.seq_len = max_length;
+    encoding.input_ids.resize(size_t(n) * max_length);
+    encoding.attention_mask.resize(size_t(n) * max_length);
+    encoding.offsets.resize(size_t(n) * 2 * max_length);
+    encode_batch_into(texts, encoding.input_ids.data(), encoding.attention_mask.data(),
+      encoding.offsets.data(), encoding.lengths.data(), num_threads, add_cls_sep,
+      max_length);
+    return;
+  }
+
+  STATS_TIMER(STAGE_BATCH);
+  // the padded length is known once every row is encoded, rows are kept in
+  // buffers of the encoding so that their capacity is reused by later calls
+  if (int(encoding.rows.size()) < n)
+  {
+    encoding.rows.resize(n);
+    encoding.row_offsets.resize(n);
+  }
+  auto weight = [&](int i) { return texts[i].size() + _text_overhead; };
+  std::vector<int> unique, source;
+  bool dedup = find_duplicates(texts, unique, source);
+  parallel_for(dedup ? unique.size() : n, num_threads, [&](int k)
+  {
+    // texts left after cancellation are skipped
+    if (cancel && cancel->cancelled())
+      return;
+    int i = dedup ? unique[k] : k;
+    CancelScope scope(cancel);
+    try
+    {
+      encode_row(texts[i], encoding.rows[i], encoding.row_offsets[i], add_cls_sep,
+        truncation || padding_to_max_length, max_length);
+    }
+    catch (const CancelledError&)
+    {
+      return;
+    }
+    encoding.lengths[i] = encoding.rows[i].size();
+  }, [&](int k) { return weight(dedup ? unique[k] : k); });
+  if (cancel && cancel->cancelled())
+    throw CancelledError();
+  for (int i = 0; dedup && i < n; i++)
+    encoding.lengths[i] = encoding.lengths[source[i]];
+
+  int seq_len = max_length;
+  if (!padding_to_max_length)
+    seq_len = n > 0 ? *std::max_element(encoding.lengths.begin(), 
+      encoding.lengths.end()) : 0;
+  encoding.seq_len = seq_len;
+  encoding.input_ids.resize(size_t(n) * seq_len);
+  encoding.attention_mask.resize(size_t(n) * seq_len);
+  encoding.offsets.resize(size_t(n) * 2 * seq_len);
+  parallel_for(n, num_threads, [&](int i)
+  {
+    size_t row = size_t(i) * seq_len;
+    int r = dedup ? source[i] : i;
+    write_row(encoding.rows[r], encoding.row_offsets[r], seq_len, _pad_id,
+      encoding.input_ids.data() + row, encoding.attention_mask.data() + row,
+      encoding.offsets.data() + 2 * row);
+  }, weight);
+}
+
+bool Tokenizer::find_duplicates(const std::vector<TextView>& texts,
+    std::vector<int>& unique,
+    std::vector<int>& source) const
+{
+  if (!_cache || texts.size() < 2)
+    return false;
+  std::unordered_map<TextView, int, TextViewHash> first;
+  first.reserve(texts.size());
+  source.resize(texts.size());
+  unique.clear();
+  for (int i = 0; i < int(texts.size()); i++)
+  {
+    auto result = first.emplace(texts[i], i);
+    source[i] = result.first->second;
+    if (result.second)
+      unique.emplace_back(i);
+  }
+  if (unique.size() == texts.size())
+    return false;
+  _cache->count_duplicates(texts.size() - unique.size());
+  return true;
+}
+
+Tokenizer::~Tokenizer()
+{
+  // a forked child never runs the tasks queued in its parent
+  std::unique_lock<std::mutex> lock(_async_mutex);
+  _async_cv.wait(lock, [this]()
+  { return _num_async == 0 || _async_generation != ThreadPool::generation(); });
+}
+
+void Tokenizer::submit(ThreadPool::Task task, int num_threads) const
+{
+  // async tasks of different callers run side by side on the workers
+  auto pool = thread_pool();
+  int num_workers = std::thread::hardware_concurrency();
+  pool->reserve(std::max(std::max(num_workers, num_threads), 1));
+  {
+    std::lock_guard<std::mutex> lock(_async_mutex);
+    _num_async++;
+    _async_generation = ThreadPool::generation();
+  }
+  // the task counts as finished once the pool drops it, after running it
+  // or if it is never queued
+  std::shared_ptr<const Tokenizer> pending(this, [](const Tokenizer* t) { t->finish_async(); });
+  pool->submit([task, pending]() { task(); });
+}
+
+void Tokenizer::finish_async() const
+{
+  // notified under the lock, the destructor may proceed once it is released
+  std::lock_guard<std::mutex> lock(_async_mutex);
+  if (--_num_async == 0)
+    _async_cv.notify_all();
+}
+
+void Tokenizer::encode_async(std::string text,
+    const EncodeCallback& callback,
+    const CancelToken& cancel,
+    bool add_cls_sep,
+    bool truncation,
+    int max_length) const
+{
+  auto input = std::make_shared<std::string>(std::move(text));
+  submit([this, input, callback, cancel, add_cls_sep, truncation, max_length]()
+  {
+    Encoding encoding;
+    std::exception_ptr error;
+    try
+    {
+      if (cancel.cancelled())
+        throw CancelledError();
+      encode(*input, encoding.input_ids, encoding.attention_mask, encoding.offsets,
         add_cls_sep, truncation, max_length);
-    #else
-    std::vector<std::thread> threads;
-    threads.reserve(static_cast<size_t>(num_threads));
-    auto func = [&](int start_index, int end_index)
+    }
+    catch (...)
+    {
+      error = std::current_exception();
+    }
+    callback(encoding, error);
+  }, 1);
+}
+
+std::future<Encoding> Tokenizer::encode_async(std::string text,
+    const CancelToken& cancel,
+    bool add_cls_sep,
+    bool truncation,
+    int max_length) const
+{
+  auto promise = std::make_shared<std::promise<Encoding>>();
+  auto future = promise->get_future();
+  encode_async(std::move(text), [promise](Encoding& encoding, std::exception_ptr error)
+  {
+    if (error)
+      promise->set_exception(error);
+    else
+      promise->set_value(std::move(encoding));
+  }, cancel, add_cls_sep, truncation, max_length);
+  return future;
+}
+
+void Tokenizer::encode_batch_async(std::vector<std::string> texts,
+    const BatchEncodeCallback& callback,
+    const CancelToken& cancel,
+    int num_threads,
+    bool add_cls_sep,
+    bool padding_to_max_length,
+    bool truncation,
+    int max_length) const
+{
+  auto inputs = std::make_shared<std::vector<std::string>>(std::move(texts));
+  submit([this, inputs, callback, cancel, num_threads, add_cls_sep,
+    padding_to_max_length, truncation, max_length]()
+  {
+    BatchEncoding encoding;
+    std::exception_ptr error;
+    try
     {
-      for (int i = start_index; i < end_index; i++)
-        encode(texts[i], input_ids[i], attention_mask[i], offsets[i], 
-          add_cls_sep, truncation, max_length);
-    };
-    int start = 0, end = 0, step = ceil(n / float(num_threads));
-    for (int i = 0; i < num_threads; i++)
+      encode_batch(views_of(*inputs), encoding, num_threads, add_cls_sep, padding_to_max_length,
+        truncation, max_length, &cancel);
+      // the per-row buffers are only needed by reused encodings
+      std::vector<std::vector<int>>().swap(encoding.rows);
+      std::vector<std::vector<int>>().swap(encoding.row_offsets);
+    }
+    catch (...)
     {
-      end = start + step;
-      if (end > n)
-        end = n;
-      threads.emplace_back(std::thread(func, start, end));
-      start = end;
+      error = std::current_exception();
     }
+    callback(encoding, error);
+  }, num_threads);
+}
 
-    for (auto& t : threads)
-      t.join();
-    #endif
+std::future<BatchEncoding> Tokenizer::encode_batch_async(std::vector<std::string> texts,
+    const CancelToken& cancel,
+    int num_threads,
+    bool add_cls_sep,
+    bool padding_to_max_length,
+    bool truncation,
+    int max_length) const
+{
+  auto promise = std::make_shared<std::promise<BatchEncoding>>();
+  auto future = promise->get_future();
+  encode_batch_async(std::move(texts), 
+    [promise](BatchEncoding& encoding, std::exception_ptr error)
+  {
+    if (error)
+      promise->set_exception(error);
+    else
+      promise->set_value(std::move(encoding));
+  }, cancel, num_threads, add_cls_sep, padding_to_max_length, truncation, max_length);
+  return future;
+}
+
+void Tokenizer::build_windows(const std::vector<int>& ids,
+    const std::vector<int>& token_offsets,
+    std::vector<std::vector<int>>& input_ids,
+    std::vector<std::vector<int>>& attention_mask,
+    std::vector<std::vector<int>>& offsets,
+    int stride, bool add_cls_sep, int max_length) const
+{
+  int window = add_cls_sep ? max_length - 2 : max_length;
+  if (window <= 0)
+    throw std::invalid_argument("max_length is too small to hold any token!");
+  if (stride < 0 || stride >= window)
+    throw std::invalid_argument("stride must be in [0, max_length - num_special_tokens)!");
+
+  int n = ids.size();
+  int start = 0, end = 0;
+  do
+  {
+    end = std::min(start + window, n);
+    input_ids.emplace_back();
+    auto& window_ids = input_ids.back();
+    window_ids.reserve(max_length);
+    if (add_cls_sep)
+      window_ids.emplace_back(_cls_id);
+    window_ids.insert(window_ids.end(), ids.begin() + start, ids.begin() + end);
+    if (add_cls_sep)
+      window_ids.emplace_back(_sep_id);
+
+    attention_mask.emplace_back(window_ids.size(), 1);
+    offsets.emplace_back(token_offsets.begin() + 2 * start,
+      token_offsets.begin() + 2 * end);
+    start = end - stride;
+  } while (end < n);
+}
+
+void Tokenizer::encode(const std::string& text,
+    std::vector<std::vector<int>>& input_ids,
+    std::vector<std::vector<int>>& attention_mask,
+    std::vector<std::vector<int>>& offsets,
+    int stride,
+    bool add_cls_sep,
+    int max_length) const
+{
+  if (input_ids.size())
+    input_ids.clear();
+  if (attention_mask.size())
+    attention_mask.clear();
+  if (offsets.size())
+    offsets.clear();
+
+  STATS_ADD(STATS_TEXTS, 1);
+  STATS_ADD(STATS_BYTES, text.size());
+  std::vector<int> ids;
+  std::vector<int> token_offsets;
+  ids.reserve(text.size());
+  token_offsets.reserve(2 * text.size());
+  wordpiece(text, ids, nullptr, token_offsets);
+  build_windows(ids, token_offsets, input_ids, attention_mask, offsets,
+    stride, add_cls_sep, max_length);
+}
+
+void Tokenizer::encode(const std::vector<std::string>& texts,
+    std::vector<std::vector<int>>& input_ids,
+    std::vector<std::vector<int>>& attention_mask,
+    std::vector<std::vector<int>>& offsets,
+    std::vector<int>& overflow_to_sample,
+    int stride,
+    int num_threads,
+    bool add_cls_sep,
+    bool padding,
+    bool padding_to_max_length,
+    int max_length) const
+{
+  if (input_ids.size())
+    input_ids.clear();
+  if (attention_mask.size())
+    attention_mask.clear();
+  if (offsets.size())
+    offsets.clear();
+  if (overflow_to_sample.size())
+    overflow_to_sample.clear();
+  STATS_TIMER(STAGE_BATCH);
+
+  // windows of each sentence
+  int n = texts.size();
+  std::vector<std::vector<std::vector<int>>> sample_input_ids(n);
+  std::vector<std::vector<std::vector<int>>> sample_attention_mask(n);
+  std::vector<std::vector<std::vector<int>>> sample_offsets(n);
+  parallel_for(n, num_threads, [&](int i)
+  {
+    encode(texts[i], sample_input_ids[i], sample_attention_mask[i],
+      sample_offsets[i], stride, add_cls_sep, max_length);
+  }, [&](int i) { return texts[i].size() + _text_overhead; });
+
+  // flatten
+  int num_windows = 0;
+  for (int i = 0; i < n; i++)
+    num_windows += sample_input_ids[i].size();
+  input_ids.reserve(num_windows);
+  attention_mask.reserve(num_windows);
+  offsets.reserve(num_windows);
+  overflow_to_sample.reserve(num_windows);
+  for (int i = 0; i < n; i++)
+  {
+    for (size_t j = 0; j < sample_input_ids[i].size(); j++)
+    {
+      input_ids.emplace_back(std::move(sample_input_ids[i][j]));
+      attention_mask.emplace_back(std::move(sample_attention_mask[i][j]));
+      offsets.emplace_back(std::move(sample_offsets[i][j]));
+      overflow_to_sample.emplace_back(i);
+    }
   }
 
-  if (!padding)
-    return;
-  
-  // padding
+  if (padding)
+    pad(input_ids, attention_mask, padding_to_max_length, max_length);
+}
+
+void Tokenizer::encode_buckets(const std::vector<std::string>& texts,
+    std::vector<Bucket>& buckets,
+    int batch_size,
+    int max_tokens,
+    int num_threads,
+    bool add_cls_sep,
+    bool truncation,
+    int max_length) const
+{
+  if (buckets.size())
+    buckets.clear();
+  if (batch_size < 1)
+    throw std::invalid_argument("batch_size must be positive!");
+
+  std::vector<std::vector<int>> input_ids;
+  std::vector<std::vector<int>> attention_mask;
+  std::vector<std::vector<int>> offsets;
+  encode(texts, input_ids, attention_mask, offsets, num_threads, add_cls_sep,
+    false, false, truncation, max_length);
+
+  // sort by length, then cut buckets while the padded size fits
+  int n = texts.size();
+  std::vector<int> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+  { return input_ids[a].size() < input_ids[b].size(); });
+
+  int start = 0;
+  while (start < n)
+  {
+    int end = start + 1;
+    while (end < n && end - start < batch_size && (max_tokens <= 0 ||
+           int(input_ids[order[end]].size()) * (end - start + 1) <= max_tokens))
+      end++;
+
+    buckets.emplace_back();
+    auto& bucket = buckets.back();
+    bucket.indices.assign(order.begin() + start, order.begin() + end);
+    bucket.input_ids.reserve(end - start);
+    bucket.attention_mask.reserve(end - start);
+    bucket.offsets.reserve(end - start);
+    for (int i = start; i < end; i++)
+    {
+      bucket.input_ids.emplace_back(std::move(input_ids[order[i]]));
+      bucket.attention_mask.emplace_back(std::move(attention_mask[order[i]]));
+      bucket.offsets.emplace_back(std::move(offsets[order[i]]));
+    }
+    pad(bucket.input_ids, bucket.attention_mask, false, max_length);
+    start = end;
+  }
+}
+
+void Tokenizer::pad(std::vector<std::vector<int>>& input_ids,
+    std::vector<std::vector<int>>& attention_mask,
+    bool padding_to_max_length, int max_length) const
+{
   int max_seq_len = std::accumulate(input_ids.begin(), input_ids.end(), 0,
     [](size_t len, const std::vector<int>& input)
     { return std::max(len, input.size()); });
   int seq_len = padding_to_max_length ? max_length : max_seq_len;
-  for (int i = 0; i < n; i++)
+  for (size_t i = 0; i < input_ids.size(); i++)
   {
     input_ids[i].resize(seq_len, _pad_id);
     attention_mask[i].resize(seq_len);
   }
 }
 
+void Tokenizer::parallel_for(int n, int num_threads,
+    const std::function<void(int)>& func,
+    const std::function<size_t(int)>& weight) const
+{
+  if (num_threads == AUTO_THREADS && n > 1)
+  {
+    size_t total = 0;
+    for (int i = 0; i < n; i++)
+      total += weight ? weight(i) : _text_overhead;
+    num_threads = auto_threads(total, n);
+  }
+  // bulk work gives way to queued interactive tasks between texts
+  std::shared_ptr<ThreadPool> bulk_pool;
+  if (ThreadPool::priority() == PRIORITY_BULK)
+    bulk_pool = thread_pool();
+  if (num_threads <= 1 || n <= 1)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      if (bulk_pool)
+        bulk_pool->yield();
+      func(i);
+    }
+    return;
+  }
+
+  // Multithreading Implementation
+  #ifdef WITH_OMP
+  #pragma omp parallel for num_threads(num_threads) schedule(dynamic)
+  for (int i = 0; i < n; i++)
+    func(i);
+  #else
+  // split into about _chunks_per_thread chunks of equal weight per thread,
+  // heaviest chunks are claimed first so that long texts do not finish last
+  std::vector<size_t> weights(n, 1);
+  size_t total = n;
+  if (weight)
+  {
+    total = 0;
+    for (int i = 0; i < n; i++)
+    {
+      weights[i] = weight(i);
+      total += weights[i];
+    }
+  }
+  size_t target = std::max(total / (num_threads * _chunks_per_thread), size_t(1));
+
+  std::vector<std::tuple<size_t, int, int>> chunks;
+  size_t sum = 0;
+  int start = 0;
+  for (int i = 0; i < n; i++)
+  {
+    sum += weights[i];
+    if (sum >= target || i == n - 1)
+    {
+      chunks.emplace_back(sum, start, i + 1);
+      sum = 0;
+      start = i + 1;
+    }
+  }
+  std::stable_sort(chunks.begin(), chunks.end(), 
+    [](const std::tuple<size_t, int, int>& a, const std::tuple<size_t, int, int>& b)
+    { return std::get<0>(a) > std::get<0>(b); });
+
+  thread_pool()->parallel_for(chunks.size(), num_threads, 1, [&](int c)
+  {
+    for (int i = std::get<1>(chunks[c]); i < std::get<2>(chunks[c]); i++)
+    {
+      if (bulk_pool)
+        bulk_pool->yield();
+      func(i);
+    }
+  });
+  #endif
+}
+
 }
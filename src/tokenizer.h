@@ -10,12 +10,23 @@
 #define EASY_TOKENIZER_H
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <limits>
+#include <mutex>
 #include <numeric>
 #include <thread>
 #include <tuple>
+#include <unordered_map>
 
 #include "dtrie.h"
+#include "encode_cache.h"
+#include "pipeline_stats.h"
+#include "text_view.h"
+#include "thread_pool.h"
 
 namespace tokenizer
 {
@@ -24,14 +35,79 @@ using WidthT  = uint_fast8_t;
 using Trie    = cedar::DTrie;
 using Token   = std::tuple<int, int, std::string>;
 
+// num_threads of the batch APIs choosing the number of threads from the
+// size of the input and the calibrated ParallelCost
+const int AUTO_THREADS = -1;
+
+// cost model of parallel execution, measured once per tokenizer
+struct ParallelCost
+{
+  double ns_per_byte = 0;    // encoding time per byte, a text adds a fixed overhead
+  double ns_per_thread = 0;  // dispatch time per additional thread
+};
+
+// memory of a tokenizer in bytes
+struct MemoryUsage
+{
+  cedar::TrieMemory vocab;
+  cedar::TrieMemory special;
+  size_t char_ids = 0;       // direct-indexed ids of single codepoint tokens
+  size_t cache = 0;          // entries and indexes of the encode cache
+  size_t cache_entries = 0;
+  // scratch buffers of the threads that encoded, including the pool 
+  // workers, shared by all tokenizers of the process
+  size_t workspaces = 0;
+  size_t num_workspaces = 0;
+
+  // memory owned by the tokenizer, mapped arrays and workspaces excluded
+  size_t total() const
+  { return vocab.allocated() + special.allocated() + char_ids + cache; }
+};
+
+// encoded sentences of similar lengths padded to their own longest row
+struct Bucket
+{
+  std::vector<int> indices;   // position of each row in the input texts
+  std::vector<std::vector<int>> input_ids;
+  std::vector<std::vector<int>> attention_mask;
+  std::vector<std::vector<int>> offsets;
+};
+
+// row-major buffers of an encoded batch, reusable across calls
+struct BatchEncoding
+{
+  int batch_size = 0;
+  int seq_len = 0;
+  std::vector<int> input_ids;       // [batch_size, seq_len]
+  std::vector<int> attention_mask;  // [batch_size, seq_len]
+  std::vector<int> offsets;         // [batch_size, 2 * seq_len]
+  std::vector<int> lengths;         // [batch_size]
+
+  // per-row buffers used before the padded length is known
+  std::vector<std::vector<int>> rows;
+  std::vector<std::vector<int>> row_offsets;
+};
+
+// encoded single sentence
+struct Encoding
+{
+  std::vector<int> input_ids;
+  std::vector<int> attention_mask;
+  std::vector<int> offsets;
+};
+
+// completion callbacks of the asynchronous APIs, error is null on success
+using EncodeCallback = std::function<void(Encoding&, std::exception_ptr)>;
+using BatchEncodeCallback = std::function<void(BatchEncoding&, std::exception_ptr)>;
+
 class BasicTokenizer
 {
   public:
     BasicTokenizer(bool do_lower_case = true);
 
     std::vector<Token> basic_tokenize(const std::string& text) const;
-    void basic_tokenize(const std::string& text, std::vector<Token>& tokens) const;
-    void tokenize(const std::string& text, int pos, std::vector<Token>& tokens) const;
+    void basic_tokenize(const TextView& text, std::vector<Token>& tokens) const;
+    void tokenize(const TextView& text, int pos, std::vector<Token>& tokens) const;
 
   protected:
     const std::string _pad_token = "[PAD]";
@@ -46,14 +122,31 @@ class BasicTokenizer
     std::unique_ptr<Trie> _special;
     std::string normalize(const uint8_t* str) const;
     int isCntrl(int c) const;
+    bool isChinese(int32_t c) const;
 };
 
 class Tokenizer : public BasicTokenizer
 {
+  friend class DecodeStream;
+
   public:
     Tokenizer(const std::string& vocab_path, 
               bool do_lower_case = true, 
               bool codepoint_level = true);
+    // waits for the asynchronous tasks still queued or running
+    ~Tokenizer();
+
+    // compact binary form of the vocabulary and special tokens, restored
+    // by deserialize without re-inserting the tokens
+    std::string serialize() const;
+    static std::unique_ptr<Tokenizer> deserialize(const std::string& data);
+
+    // write the binary form to path; open maps such a file read-only, so 
+    // processes opening it share its memory instead of copying it
+    void save(const std::string& path) const;
+    static std::unique_ptr<Tokenizer> open(const std::string& path);
+    // file the tokenizer was opened from, empty if none or once modified
+    const std::string& path() const;
 
     void insert(const std::string& token);
     void insert(const std::vector<std::string>& tokens);
@@ -76,6 +169,36 @@ class Tokenizer : public BasicTokenizer
     int mask_id() const;
     int get_id(const std::string& token) const;
 
+    // persistent worker pool used by the batch APIs, by default each 
+    // tokenizer owns a pool that grows to the requested num_threads,
+    // queue_capacity bounds the tasks queued by the asynchronous APIs
+    void set_thread_pool(int max_threads, bool pin_threads = false,
+        size_t queue_capacity = _max_queued_tasks);
+    void set_thread_pool(const std::shared_ptr<ThreadPool>& pool);
+    std::shared_ptr<ThreadPool> thread_pool() const;
+
+    // bounded cache of encoded texts shared by the encode APIs, identical
+    // texts of a batch are then also encoded once; capacity 0 disables it,
+    // not safe while other threads encode
+    void set_cache(size_t capacity, int num_shards = 16);
+    std::shared_ptr<EncodeCache> cache() const;
+    CacheStats cache_stats() const;
+
+    // allocated and used memory of the tries, the caches and the
+    // per-thread buffers
+    MemoryUsage memory_usage() const;
+
+    // pipeline counters and per-stage latency histograms summed over the 
+    // threads since construction or the last reset_stats, only recorded 
+    // when compiled with WITH_STATS and empty otherwise
+    PipelineStats stats() const;
+    void reset_stats();
+
+    // number of threads chosen by AUTO_THREADS for num_tasks tasks of
+    // num_bytes bytes in total, 1 below the break-even point
+    int auto_threads(size_t num_bytes, int num_tasks) const;
+    const ParallelCost& parallel_cost() const;
+
     bool count(const std::string& token) const;
     std::vector<std::string> convert_ids_to_tokens(const std::vector<int>& input_ids) const;
     std::vector<int> convert_tokens_to_ids(const std::vector<std::string>& tokens,
@@ -84,12 +207,48 @@ class Tokenizer : public BasicTokenizer
         std::vector<int>& input_ids,
         bool add_cls_sep = false) const;
 
+    // decode input ids into text
+    std::string decode(const std::vector<int>& input_ids,
+        bool skip_special_tokens = true,
+        bool clean_up_tokenization_spaces = true) const;
+    void decode(const std::vector<int>& input_ids,
+        std::string& text,
+        bool skip_special_tokens = true,
+        bool clean_up_tokenization_spaces = true) const;
+    void batch_decode(const std::vector<std::vector<int>>& input_ids,
+        std::vector<std::string>& texts,
+        int num_threads = 1,
+        bool skip_special_tokens = true,
+        bool clean_up_tokenization_spaces = true) const;
+
     // wordpiece tokenize
     std::vector<std::string> wordpiece_tokenize(const std::string& text) const;
     void wordpiece_tokenize(const std::string& text,
         std::vector<std::string>& tokens,
         std::vector<int>& offsets) const;
 
+    // batch variants with flat results, the items of row i are
+    // [row_offsets[i], row_offsets[i + 1]) of the flat result
+    void batch_tokenize(const std::vector<std::string>& texts,
+        std::vector<std::string>& tokens,
+        std::vector<size_t>& row_offsets,
+        int num_threads = 1) const;
+    void batch_convert_ids_to_tokens(const std::vector<std::vector<int>>& input_ids,
+        std::vector<std::string>& tokens,
+        std::vector<size_t>& row_offsets,
+        int num_threads = 1) const;
+    void batch_convert_tokens_to_ids(const std::vector<std::vector<std::string>>& tokens,
+        std::vector<int>& input_ids,
+        std::vector<size_t>& row_offsets,
+        int num_threads = 1,
+        bool add_cls_sep = false) const;
+
+    // number of input ids of each text encoded without truncation
+    void count_tokens(const std::vector<std::string>& texts,
+        std::vector<int>& counts,
+        int num_threads = 1,
+        bool add_cls_sep = false) const;
+
     // encode single sentence
     std::vector<int> encode(const std::string& text,
         bool add_cls_sep = true,
@@ -103,6 +262,18 @@ class Tokenizer : public BasicTokenizer
         bool truncation = true,
         int max_length = 512) const;
 
+    // encode single long sentence split into segments at points where
+    // tokenization restarts, segments are encoded on num_threads threads
+    // and the output is the same as the sequential one
+    void encode_parallel(const std::string& text,
+        std::vector<int>& input_ids,
+        std::vector<int>& attention_mask,
+        std::vector<int>& offsets,
+        int num_threads,
+        bool add_cls_sep = true,
+        bool truncation = true,
+        int max_length = 512) const;
+
     // encode batch sentences
     void encode(const std::vector<std::string>& texts,
         std::vector<std::vector<int>>& input_ids,
@@ -114,18 +285,219 @@ class Tokenizer : public BasicTokenizer
         bool padding_to_max_length = false,
         bool truncation = true,
         int max_length = 512) const;
+    // same on views of texts owned by the caller, which are not copied
+    void encode(const std::vector<TextView>& texts,
+        std::vector<std::vector<int>>& input_ids,
+        std::vector<std::vector<int>>& attention_mask,
+        std::vector<std::vector<int>>& offsets,
+        int num_threads = 1,
+        bool add_cls_sep = true,
+        bool padding = true,
+        bool padding_to_max_length = false,
+        bool truncation = true,
+        int max_length = 512) const;
+
+    // encode batch sentences until cancel is cancelled or its deadline
+    // passes, checked between texts and inside long texts; completed[i]
+    // is 0 for the rows left unfinished, which are empty before padding
+    void encode(const std::vector<std::string>& texts,
+        std::vector<std::vector<int>>& input_ids,
+        std::vector<std::vector<int>>& attention_mask,
+        std::vector<std::vector<int>>& offsets,
+        std::vector<int>& completed,
+        const CancelToken& cancel,
+        int num_threads = 1,
+        bool add_cls_sep = true,
+        bool padding = true,
+        bool padding_to_max_length = false,
+        bool truncation = true,
+        int max_length = 512) const;
+
+    // encode single sentence into overflowing windows of max_length,
+    // consecutive windows share stride tokens
+    void encode(const std::string& text,
+        std::vector<std::vector<int>>& input_ids,
+        std::vector<std::vector<int>>& attention_mask,
+        std::vector<std::vector<int>>& offsets,
+        int stride,
+        bool add_cls_sep = true,
+        int max_length = 512) const;
+
+    // encode batch sentences into overflowing windows, overflow_to_sample
+    // maps each window to the index of its source sentence
+    void encode(const std::vector<std::string>& texts,
+        std::vector<std::vector<int>>& input_ids,
+        std::vector<std::vector<int>>& attention_mask,
+        std::vector<std::vector<int>>& offsets,
+        std::vector<int>& overflow_to_sample,
+        int stride,
+        int num_threads = 1,
+        bool add_cls_sep = true,
+        bool padding = true,
+        bool padding_to_max_length = false,
+        int max_length = 512) const;
+
+    // encode batch sentences into contiguous buffers of the encoding
+    void encode_batch_into(const std::vector<std::string>& texts,
+        BatchEncoding& encoding,
+        int num_threads = 1,
+        bool add_cls_sep = true,
+        bool padding_to_max_length = false,
+        bool truncation = true,
+        int max_length = 512) const;
+    void encode_batch_into(const std::vector<TextView>& texts,
+        BatchEncoding& encoding,
+        int num_threads = 1,
+        bool add_cls_sep = true,
+        bool padding_to_max_length = false,
+        bool truncation = true,
+        int max_length = 512) const;
+
+    // encode batch sentences into caller-provided row-major buffers of
+    // [batch_size, max_length] ints (offsets: [batch_size, 2 * max_length]),
+    // rows are truncated to max_length, attention_mask, offsets and 
+    // lengths may be null
+    void encode_batch_into(const std::vector<std::string>& texts,
+        int* input_ids,
+        int* attention_mask,
+        int* offsets,
+        int* lengths,
+        int num_threads = 1,
+        bool add_cls_sep = true,
+        int max_length = 512) const;
+    void encode_batch_into(const std::vector<TextView>& texts,
+        int* input_ids,
+        int* attention_mask,
+        int* offsets,
+        int* lengths,
+        int num_threads = 1,
+        bool add_cls_sep = true,
+        int max_length = 512) const;
+
+    // encode batch sentences into length buckets of at most batch_size rows
+    // and, if max_tokens > 0, at most max_tokens padded tokens
+    void encode_buckets(const std::vector<std::string>& texts,
+        std::vector<Bucket>& buckets,
+        int batch_size,
+        int max_tokens = 0,
+        int num_threads = 1,
+        bool add_cls_sep = true,
+        bool truncation = true,
+        int max_length = 512) const;
+
+    // encode on the worker pool, destroying the tokenizer waits for the
+    // queued work; submitting blocks while the pool queue is full and work
+    // cancelled before it finishes fails with CancelledError
+    std::future<Encoding> encode_async(std::string text,
+        const CancelToken& cancel = CancelToken(),
+        bool add_cls_sep = true,
+        bool truncation = true,
+        int max_length = 512) const;
+    std::future<BatchEncoding> encode_batch_async(std::vector<std::string> texts,
+        const CancelToken& cancel = CancelToken(),
+        int num_threads = 1,
+        bool add_cls_sep = true,
+        bool padding_to_max_length = false,
+        bool truncation = true,
+        int max_length = 512) const;
+
+    // same with callbacks, run on a worker thread, that must not throw
+    void encode_async(std::string text,
+        const EncodeCallback& callback,
+        const CancelToken& cancel = CancelToken(),
+        bool add_cls_sep = true,
+        bool truncation = true,
+        int max_length = 512) const;
+    void encode_batch_async(std::vector<std::string> texts,
+        const BatchEncodeCallback& callback,
+        const CancelToken& cancel = CancelToken(),
+        int num_threads = 1,
+        bool add_cls_sep = true,
+        bool padding_to_max_length = false,
+        bool truncation = true,
+        int max_length = 512) const;
   
   protected:
+    struct LoadTag {};
+    Tokenizer(LoadTag, const char* data, size_t size,
+              const std::shared_ptr<const void>& storage);
+
     std::unique_ptr<Trie> _vocab;
     bool _codepoint_level = true;
+    std::string _path;
     int _pad_id, _cls_id, _sep_id, _unk_id, _mask_id;
     static const int _max_input_chars_per_word = 100;
 
+    // direct-indexed ids of single codepoint tokens in the BMP
+    static const int _num_char_ids = 0x10000;
+    std::vector<int> _char_ids;
+
+    // fixed cost of a text in bytes when balancing work
+    static const int _text_overhead = 64;
+    static const int _chunks_per_thread = 8;
+    static const size_t _max_queued_tasks = 1024;
+
+    // texts are split into segments of at least _min_segment_bytes, 
+    // unless matches of special tokens may overlap
+    static const int _min_segment_bytes = 1 << 16;
+    bool _special_overlap = false;
+    size_t _max_special_len = 0;
+
+    mutable std::mutex _pool_mutex;
+    mutable std::shared_ptr<ThreadPool> _pool;
+    std::shared_ptr<EncodeCache> _cache;
+    mutable std::once_flag _cost_flag;
+    mutable ParallelCost _cost;
+    std::unique_ptr<StatsRegistry> _stats;  // null without WITH_STATS
+
+    // asynchronous tasks not finished yet, they use the members above
+    mutable std::mutex _async_mutex;
+    mutable std::condition_variable _async_cv;
+    mutable int _num_async = 0;
+    mutable int _async_generation = 0;
+
     void load_vocab(const std::string& vocab_path);
+    int lookup(const std::string& token) const;
+    void update_char_ids(const std::string& token, int id);
+    void invalidate();
+    void update_special(const std::string& token);
+    size_t next_split(const std::string& text, size_t pos) const;
+    bool truncate(std::vector<int>& input_ids,
+        std::vector<int>& offsets,
+        bool add_cls_sep, int max_length) const;
+    void encode_batch(const std::vector<TextView>& texts,
+        BatchEncoding& encoding,
+        int num_threads, bool add_cls_sep, bool padding_to_max_length,
+        bool truncation, int max_length, const CancelToken* cancel) const;
+    void submit(ThreadPool::Task task, int num_threads) const;
+    void finish_async() const;
+    void calibrate() const;
+    bool find_duplicates(const std::vector<TextView>& texts,
+        std::vector<int>& unique,
+        std::vector<int>& source) const;
+    void encode_masked_row(const TextView& text,
+        std::vector<int>& input_ids,
+        std::vector<int>& attention_mask,
+        std::vector<int>& offsets,
+        bool add_cls_sep, bool truncation, int max_length) const;
+    bool encode_row(const TextView& text,
+        std::vector<int>& input_ids,
+        std::vector<int>& offsets,
+        bool add_cls_sep, bool truncation, int max_length,
+        bool update_cache = true) const;
+    bool encode_uncached(const TextView& text,
+        std::vector<int>& input_ids,
+        std::vector<int>& offsets,
+        bool add_cls_sep, bool truncation, int max_length) const;
+    void wordpiece(const TextView& text,
+        std::vector<int>& input_ids,
+        std::vector<std::string>* tokens,
+        std::vector<int>& offsets) const;
+    void count_wordpieces(const std::vector<int>& input_ids, size_t first) const;
     bool isAlnum(const char* str, int len) const;
     void build_pos_map(const char* str, int len, 
         std::vector<int>& pos_map) const;
-    void build_index_map(const std::string& text, 
+    void build_index_map(const TextView& text, 
         std::vector<int>& byte2index) const;
 
     int NFD_codepoint_number(const uint8_t* str) const;    
@@ -134,6 +506,43 @@ class Tokenizer : public BasicTokenizer
     WidthT get_num_bytes_of_utf8_char(const char* str, int len) const;
 
     int search(const char* str, int len, int index) const;
+
+    void build_windows(const std::vector<int>& ids,
+        const std::vector<int>& token_offsets,
+        std::vector<std::vector<int>>& input_ids,
+        std::vector<std::vector<int>>& attention_mask,
+        std::vector<std::vector<int>>& offsets,
+        int stride, bool add_cls_sep, int max_length) const;
+    void decode_token(int id, int& state, std::string& text,
+        bool skip_special_tokens, bool clean_up_tokenization_spaces) const;
+    void pad(std::vector<std::vector<int>>& input_ids,
+        std::vector<std::vector<int>>& attention_mask,
+        bool padding_to_max_length, int max_length) const;
+    // run func(i) for i in [0, n), dynamically balancing the total weight
+    void parallel_for(int n, int num_threads,
+        const std::function<void(int)>& func,
+        const std::function<size_t(int)>& weight = nullptr) const;
+};
+
+// incremental decoding of ids generated one by one
+class DecodeStream
+{
+  public:
+    DecodeStream(const Tokenizer& tokenizer,
+                 bool skip_special_tokens = true,
+                 bool clean_up_tokenization_spaces = true);
+
+    // return the text finalized by id
+    std::string step(int id);
+    // append the text finalized by id
+    void step(int id, std::string& text);
+    void reset();
+
+  protected:
+    const Tokenizer& _tokenizer;
+    bool _skip_special_tokens;
+    bool _clean_up_tokenization_spaces;
+    int _state;
 };
 
 }
@@ -0,0 +1,109 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "tokenizer.h"
+
+// callbacks run on the pool workers, so a callback submitting more work
+// must not wait for a queue slot only the workers could free
+int chained_callbacks(const tokenizer::Tokenizer& AutoTokenizer, const std::string& text,
+    size_t expected)
+{
+  const int num_texts = 3000;
+  std::mutex mutex;
+  std::condition_variable cv;
+  int done = 0, failures = 0;
+  auto finish = [&](tokenizer::Encoding& encoding, std::exception_ptr error)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    failures += error || encoding.input_ids.size() != expected;
+    if (++done == 2 * num_texts)
+      cv.notify_all();
+  };
+  for (int i = 0; i < num_texts; i++)
+  {
+    AutoTokenizer.encode_async(text, [&](tokenizer::Encoding& encoding, std::exception_ptr error)
+    {
+      AutoTokenizer.encode_async(text, finish);
+      finish(encoding, error);
+    });
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  if (!cv.wait_for(lock, std::chrono::seconds(60), [&]() { return done == 2 * num_texts; }))
+  {
+    std::cerr << "chained callbacks did not finish" << std::endl;
+    return 1;
+  }
+  if (failures)
+    std::cerr << failures << " chained results are wrong" << std::endl;
+  return failures;
+}
+
+// work cancelled before it runs fails with CancelledError, through the
+// futures and the callbacks
+int cancelled_work(const tokenizer::Tokenizer& AutoTokenizer, const std::string& text)
+{
+  tokenizer::CancelToken cancel;
+  cancel.cancel();
+  int failures = 0;
+  auto future = AutoTokenizer.encode_async(text, cancel);
+  auto batch_future = AutoTokenizer.encode_batch_async(
+    std::vector<std::string>(4, text), cancel);
+  try
+  {
+    future.get();
+    failures++;
+  }
+  catch (const tokenizer::CancelledError&) {}
+  try
+  {
+    batch_future.get();
+    failures++;
+  }
+  catch (const tokenizer::CancelledError&) {}
+
+  std::promise<bool> cancelled;
+  AutoTokenizer.encode_async(text, [&](tokenizer::Encoding&, std::exception_ptr error)
+  {
+    bool is_cancelled = false;
+    try
+    {
+      if (error)
+        std::rethrow_exception(error);
+    }
+    catch (const tokenizer::CancelledError&)
+    {
+      is_cancelled = true;
+    }
+    catch (...) {}
+    cancelled.set_value(is_cancelled);
+  }, cancel);
+  failures += !cancelled.get_future().get();
+  if (failures)
+    std::cerr << failures << " cancelled tasks did not fail" << std::endl;
+  return failures;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    std::cerr << "usage: async_callback_test vocab_path" << std::endl;
+    return 1;
+  }
+
+  std::string text = "计算机科学与技术（Computer Science and Technology）是一门专业。";
+  tokenizer::Tokenizer AutoTokenizer(argv[1]);
+  size_t expected = AutoTokenizer.encode(text).size();
+  AutoTokenizer.set_thread_pool(2, false, 16);
+
+  int failures = chained_callbacks(AutoTokenizer, text, expected);
+  failures += cancelled_work(AutoTokenizer, text);
+  return failures ? 1 : 0;
+}
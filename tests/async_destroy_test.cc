@@ -0,0 +1,56 @@
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "tokenizer.h"
+
+// destroying a tokenizer with queued asynchronous work waits for it, so
+// the pending futures complete against a live tokenizer
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    std::cerr << "usage: async_destroy_test vocab_path" << std::endl;
+    return 1;
+  }
+
+  std::string text;
+  for (int i = 0; i < 10; i++)
+    text.append("计算机科学与技术（Computer Science and Technology）是一门专业。");
+  std::vector<size_t> expected;
+  std::vector<std::future<tokenizer::Encoding>> futures;
+  std::vector<std::future<tokenizer::BatchEncoding>> batch_futures;
+  {
+    tokenizer::Tokenizer AutoTokenizer(argv[1]);
+    for (int i = 0; i < 200; i++)
+      expected.emplace_back(AutoTokenizer.encode(text + std::to_string(i)).size());
+    AutoTokenizer.set_thread_pool(2);
+    AutoTokenizer.set_cache(16);
+    for (int i = 0; i < 200; i++)
+      futures.emplace_back(AutoTokenizer.encode_async(text + std::to_string(i)));
+    for (int i = 0; i < 20; i++)
+      batch_futures.emplace_back(AutoTokenizer.encode_batch_async(
+        std::vector<std::string>(8, text + std::to_string(i)), tokenizer::CancelToken(), 2));
+  }
+
+  int failures = 0;
+  for (size_t i = 0; i < futures.size(); i++)
+  {
+    tokenizer::Encoding encoding = futures[i].get();
+    if (encoding.input_ids.size() != expected[i])
+      failures++;
+  }
+  for (size_t i = 0; i < batch_futures.size(); i++)
+  {
+    tokenizer::BatchEncoding encoding = batch_futures[i].get();
+    if (encoding.batch_size != 8 || size_t(encoding.seq_len) != expected[i])
+      failures++;
+  }
+  if (failures)
+  {
+    std::cerr << failures << " async results are wrong" << std::endl;
+    return 1;
+  }
+  return 0;
+}